@@ -3,10 +3,16 @@
 #include <debug.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 #include "devices/timer.h"
 #include "threads/io.h"
+#include "threads/thread.h"
+#include "intrinsic.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -32,9 +38,11 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
+#define CTL_NIEN 0x02           /* Disable interrupts. */
 
 /* Device Register bits. */
 #define DEV_MBS 0xa0            /* Must be set. */
@@ -47,6 +55,60 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+
+/* The same transfers with 48-bit sector numbers, for sectors past
+   the 28 bits that the commands above can address. */
+#define CMD_READ_SECTOR_EXT 0x24        /* READ SECTOR EXT. */
+#define CMD_WRITE_SECTOR_EXT 0x34       /* WRITE SECTOR EXT. */
+#define CMD_READ_DMA_EXT 0x25           /* READ DMA EXT. */
+#define CMD_WRITE_DMA_EXT 0x35          /* WRITE DMA EXT. */
+#define CMD_READ_MULTIPLE_EXT 0x29      /* READ MULTIPLE EXT. */
+#define CMD_WRITE_MULTIPLE_EXT 0x39     /* WRITE MULTIPLE EXT. */
+
+/* Bus master IDE registers, found through the PCI IDE
+   controller's BAR4.  Each channel has its own set of three, the
+   secondary channel's 8 bytes after the primary's.  See the
+   "Programming Interface for Bus Master IDE Controller"
+   specification. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
+/* Bus master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_READ 0x08        /* Transfer from disk to memory. */
+
+/* Bus master Status Register bits. */
+#define BM_STA_ERR 0x02         /* Error, write 1 to clear. */
+#define BM_STA_INTR 0x04        /* Interrupt, write 1 to clear. */
+
+/* A physical region descriptor: one physically contiguous piece
+   of a DMA transfer's buffer.  A region may not cross a 64 kB
+   boundary. */
+struct prd {
+	uint32_t addr;              /* Physical address of region. */
+	uint16_t size;              /* Size in bytes, 0 meaning 64 kB. */
+	uint16_t flags;             /* PRD_EOT on the last descriptor. */
+};
+#define PRD_EOT 0x8000          /* End of table. */
+
+
+/* PCI configuration space access ports. */
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* Ticks a request may wait before schedule() takes it ahead of
+   the rest: reads are waited for, writes mostly are not. */
+#define READ_DEADLINE (TIMER_FREQ / 2)
+#define WRITE_DEADLINE (5 * TIMER_FREQ)
+
+/* If true, never use DMA, only PIO.  Set by the -pio option. */
+bool disk_pio_only;
 
 /* An ATA device. */
 struct disk {
@@ -56,9 +118,18 @@ struct disk {
 
 	bool is_ata;                /* 1=This device is an ATA disk. */
 	disk_sector_t capacity;     /* Capacity in sectors (if is_ata). */
+	bool dma;                   /* Use DMA rather than PIO? */
+	bool lba48;                 /* Supports 48-bit sector numbers? */
+	size_t multiple;            /* Sectors per PIO interrupt with READ/WRITE
+								   MULTIPLE, or 0 to move one at a time. */
 
 	long long read_cnt;         /* Number of sectors read. */
 	long long write_cnt;        /* Number of sectors written. */
+
+	/* Accessed with interrupts off. */
+	struct disk_stats stats;    /* I/O statistics. */
+	size_t depth;               /* Requests queued or in progress. */
+	disk_sector_t last_end;     /* Sector after the last request submitted. */
 };
 
 /* An ATA channel (aka controller).
@@ -67,12 +138,28 @@ struct channel {
 	char name[8];               /* Name, e.g. "hd0". */
 	uint16_t reg_base;          /* Base I/O port. */
 	uint8_t irq;                /* Interrupt in use. */
+	uint16_t bm_base;           /* Bus master I/O port, or 0 for PIO only. */
+	struct prd *prdt;           /* Physical region descriptor table. */
 
-	struct lock lock;           /* Must acquire to access the controller. */
 	bool expecting_interrupt;   /* True if an interrupt is expected, false if
 								   any interrupt would be spurious. */
 	struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+	/* Requests wait in QUEUE until schedule() picks them.  The
+	   requests in BATCH cover consecutive sectors of one disk in
+	   one direction and are carried out by a single ATA command,
+	   started by the interrupt that ends the one before.  These
+	   members are accessed with interrupts off. */
+	struct list queue;          /* Pending disk_requests. */
+	struct list batch;          /* Requests of the command in progress. */
+	struct disk_request *cur;   /* Request holding the next PIO sector. */
+	bool dma;                   /* Batch being transferred by DMA? */
+	bool drq_wait;              /* PIO write waiting, in the PIO thread, for
+								   the disk to ask for its first block? */
+	struct semaphore drq_sema;  /* Up'd to hand such a write to the PIO
+								   thread. */
+	uint64_t head;              /* Scheduling key where the last batch ended. */
+
 	struct disk devices[2];     /* The devices on this channel. */
 };
 
@@ -83,11 +170,27 @@ static struct channel channels[CHANNEL_CNT];
 static void reset_channel (struct channel *);
 static bool check_device_type (struct disk *);
 static void identify_ata_device (struct disk *);
+static void set_multiple_mode (struct disk *, size_t max);
 
-static void select_sector (struct disk *, disk_sector_t);
+static uint16_t find_bus_master (void);
+static bool select_sector (struct disk *, disk_sector_t, size_t cnt);
+static uint8_t transfer_command (const struct disk *, bool dma, bool write,
+		bool lba48);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
+static bool drq_ready (const struct channel *);
+static bool wait_for_drq (const struct disk *);
+static void pio_thread (void *);
+
+static void start_request (struct channel *);
+static void schedule (struct channel *);
+static void issue_batch (struct channel *);
+static void service_request (struct channel *, uint8_t status);
+static void complete_batch (struct channel *, bool error);
+static void fail_batch (struct channel *);
+static bool dma_start (struct channel *);
+static bool dma_finish (struct channel *);
 
 static void wait_until_idle (const struct disk *);
 static bool wait_while_busy (const struct disk *);
@@ -99,6 +202,7 @@ static void interrupt_handler (struct intr_frame *);
 /* Initialize the disk subsystem and detect disks. */
 void
 disk_init (void) {
+	uint16_t bm_base = disk_pio_only ? 0 : find_bus_master ();
 	size_t chan_no;
 
 	for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++) {
@@ -119,9 +223,24 @@ disk_init (void) {
 			default:
 				NOT_REACHED ();
 		}
-		lock_init (&c->lock);
 		c->expecting_interrupt = false;
 		sema_init (&c->completion_wait, 0);
+		list_init (&c->queue);
+		list_init (&c->batch);
+		c->cur = NULL;
+		c->dma = false;
+		c->head = 0;
+		c->drq_wait = false;
+		sema_init (&c->drq_sema, 0);
+
+		/* Set up bus master DMA, if there is a controller for it. */
+		c->bm_base = 0;
+		c->prdt = NULL;
+		if (bm_base != 0) {
+			c->prdt = palloc_get_page (0);
+			if (c->prdt != NULL)
+				c->bm_base = bm_base + chan_no * 8;
+		}
 
 		/* Initialize devices. */
 		for (dev_no = 0; dev_no < 2; dev_no++) {
@@ -132,8 +251,14 @@ disk_init (void) {
 
 			d->is_ata = false;
 			d->capacity = 0;
+			d->dma = false;
+			d->lba48 = false;
+			d->multiple = 0;
 
 			d->read_cnt = d->write_cnt = 0;
+			memset (&d->stats, 0, sizeof d->stats);
+			d->depth = 0;
+			d->last_end = 0;
 		}
 
 		/* Register interrupt handler. */
@@ -150,6 +275,9 @@ disk_init (void) {
 		for (dev_no = 0; dev_no < 2; dev_no++)
 			if (c->devices[dev_no].is_ata)
 				identify_ata_device (&c->devices[dev_no]);
+
+		if (thread_create (c->name, PRI_MAX, pio_thread, c) == TID_ERROR)
+			PANIC ("%s: can't start PIO thread", c->name);
 	}
 
 	/* DO NOT MODIFY BELOW LINES. */
@@ -166,13 +294,64 @@ disk_print_stats (void) {
 
 		for (dev_no = 0; dev_no < 2; dev_no++) {
 			struct disk *d = disk_get (chan_no, dev_no);
-			if (d != NULL && d->is_ata)
-				printf ("%s: %lld reads, %lld writes\n",
-						d->name, d->read_cnt, d->write_cnt);
+			const struct disk_stats *s;
+
+			if (d == NULL || !d->is_ata)
+				continue;
+			printf ("%s: %lld reads, %lld writes\n",
+					d->name, d->read_cnt, d->write_cnt);
+
+			s = &d->stats;
+			if (s->depth_samples == 0)
+				continue;
+			printf ("%s: %"PRIu64" of %"PRIu64" requests sequential, "
+					"mean latency %"PRIu64" us, queue depth %"PRIu64" max\n",
+					d->name, s->read.sequential + s->write.sequential,
+					s->read.cnt + s->write.cnt,
+					clock_cycles_to_ns (s->read.cycles + s->write.cycles)
+					/ (s->read.cnt + s->write.cnt > 0 ? s->read.cnt + s->write.cnt : 1)
+					/ 1000,
+					s->depth_max);
 		}
 	}
 }
 
+/* Copies the statistics of the disk numbered DEV_NO within the
+   channel numbered CHAN_NO, as in disk_get(), into *STATS.
+   Returns false if there is no such disk. */
+bool
+disk_get_stats (int chan_no, int dev_no, struct disk_stats *stats) {
+	struct disk *d;
+	enum intr_level old_level;
+
+	if (chan_no < 0 || chan_no >= (int) CHANNEL_CNT
+			|| (dev_no != 0 && dev_no != 1))
+		return false;
+	d = disk_get (chan_no, dev_no);
+	if (d == NULL)
+		return false;
+
+	old_level = intr_disable ();
+	*stats = d->stats;
+	intr_set_level (old_level);
+	return true;
+}
+
+/* Makes the running thread charge the disk requests it sets up
+   from now on to ORIGIN in disk statistics, and returns the
+   origin they were charged to before, for the caller to put
+   back when it is done. */
+enum disk_origin
+disk_set_origin (enum disk_origin origin) {
+	struct thread *t = thread_current ();
+	enum disk_origin old = t->disk_origin;
+
+	ASSERT (origin < DISK_ORIGIN_CNT);
+
+	t->disk_origin = origin;
+	return old;
+}
+
 /* Returns the disk numbered DEV_NO--either 0 or 1 for master or
    slave, respectively--within the channel numbered CHAN_NO.
 
@@ -203,27 +382,165 @@ disk_size (struct disk *d) {
 	return d->capacity;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for DISK_SECTOR_SIZE bytes.
-   Internally synchronizes accesses to disks, so external
-   per-disk locking is unneeded. */
+/* Initializes request R to transfer CNT sectors, starting at
+   SEC_NO, between a disk and BUFFER: from the disk into BUFFER
+   if WRITE is false, from BUFFER to the disk if it is true.
+   BUFFER must be a kernel address, since the transfer may happen
+   in an interrupt handler while another process is running.  If
+   FUNC is non-null, it is called with R and AUX when R
+   completes. */
 void
-disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
+disk_request_init (struct disk_request *r, disk_sector_t sec_no,
+		void *buffer, size_t cnt, bool write,
+		disk_request_func *func, void *aux) {
+	ASSERT (buffer != NULL);
+	ASSERT (is_kernel_vaddr (buffer));
+	ASSERT (cnt > 0 && cnt <= DISK_TRANSFER_MAX);
+
+	r->disk = NULL;
+	r->sec_no = sec_no;
+	r->buffer = buffer;
+	r->cnt = cnt;
+	r->write = write;
+	r->func = func;
+	r->aux = aux;
+	r->done_cnt = 0;
+	r->error = false;
+	r->deadline = 0;
+	r->origin = thread_current ()->disk_origin;
+	r->start_tsc = 0;
+	sema_init (&r->done, 0);
+}
+
+/* Accounts in disk D's statistics for the submission of request
+   R: the depth of D's queue that R joins, and whether R continues
+   where the request before it ended.  Must be called with
+   interrupts off. */
+static void
+record_submit (struct disk *d, const struct disk_request *r) {
+	struct disk_stats *s = &d->stats;
+	struct disk_op_stats *op = r->write ? &s->write : &s->read;
+
+	d->depth++;
+	s->depth_samples++;
+	s->depth_sum += d->depth;
+	if (d->depth > s->depth_max)
+		s->depth_max = d->depth;
+
+	if (r->sec_no == d->last_end)
+		op->sequential++;
+	d->last_end = r->sec_no + r->cnt;
+}
+
+/* Accounts in disk D's statistics for the completion of request
+   R.  Must be called with interrupts off. */
+static void
+record_complete (struct disk *d, const struct disk_request *r) {
+	struct disk_stats *s = &d->stats;
+	struct disk_op_stats *op = r->write ? &s->write : &s->read;
+	uint64_t cycles = rdtsc () - r->start_tsc;
+	size_t bucket = 0;
+
+	while (bucket + 1 < DISK_LATENCY_BUCKETS && cycles >> (bucket + 1) != 0)
+		bucket++;
+
+	d->depth--;
+	op->cnt++;
+	op->sectors += r->cnt;
+	op->cycles += cycles;
+	if (cycles > op->max_cycles)
+		op->max_cycles = cycles;
+	op->latency[bucket]++;
+	s->origin_sectors[r->origin] += r->cnt;
+}
+
+/* Queues request R for disk D and returns without waiting for
+   it.  The order in which requests are carried out is up to
+   schedule().  When R completes, its callback, if any, is
+   called from the disk interrupt handler, so it must not sleep;
+   then anyone in disk_wait() on R wakes up.  R and its buffer
+   must stay put until then.  A callback may free R, but then
+   nobody may wait for it. */
+void
+disk_submit (struct disk *d, struct disk_request *r) {
 	struct channel *c;
+	enum intr_level old_level;
 
 	ASSERT (d != NULL);
-	ASSERT (buffer != NULL);
+	ASSERT (r->sec_no < d->capacity && r->cnt <= d->capacity - r->sec_no);
 
 	c = d->channel;
-	lock_acquire (&c->lock);
-	select_sector (d, sec_no);
-	issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-	sema_down (&c->completion_wait);
-	if (!wait_while_busy (d))
-		PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-	input_sector (c, buffer);
-	d->read_cnt++;
-	lock_release (&c->lock);
+	r->disk = d;
+	r->done_cnt = 0;
+	r->error = false;
+	r->deadline = timer_ticks () + (r->write ? WRITE_DEADLINE : READ_DEADLINE);
+	old_level = intr_disable ();
+	r->start_tsc = rdtsc ();
+	record_submit (d, r);
+	list_push_back (&c->queue, &r->elem);
+	start_request (c);
+	intr_set_level (old_level);
+}
+
+/* Waits for request R to complete.  Returns true if it
+   succeeded, false if the disk reported an error. */
+bool
+disk_wait (struct disk_request *r) {
+	sema_down (&r->done);
+	return !r->error;
+}
+
+/* Transfers CNT consecutive sectors, starting at SEC_NO, between
+   disk D and BUFFER, as described in disk_request_init(), and
+   waits for them.  Each DISK_TRANSFER_MAX sectors go in one
+   request, and so in one ATA command.  A buffer in user memory
+   is copied through a kernel buffer, in this thread, so that
+   page faults on it are handled as usual. */
+static void
+transfer (struct disk *d, disk_sector_t sec_no, void *buffer, size_t cnt,
+		bool write) {
+	ASSERT (d != NULL);
+	ASSERT (buffer != NULL);
+
+	while (cnt > 0) {
+		size_t chunk = cnt < DISK_TRANSFER_MAX ? cnt : DISK_TRANSFER_MAX;
+		size_t size = chunk * DISK_SECTOR_SIZE;
+		struct disk_request r;
+		void *kbuf = buffer;
+
+		if (!is_kernel_vaddr (buffer)) {
+			kbuf = malloc (size);
+			if (kbuf == NULL)
+				PANIC ("%s: out of memory for bounce buffer", d->name);
+			if (write)
+				memcpy (kbuf, buffer, size);
+		}
+
+		disk_request_init (&r, sec_no, kbuf, chunk, write, NULL, NULL);
+		disk_submit (d, &r);
+		if (!disk_wait (&r))
+			PANIC ("%s: disk %s failed, sector=%"PRDSNu,
+					d->name, write ? "write" : "read", sec_no);
+
+		if (kbuf != buffer) {
+			if (!write)
+				memcpy (buffer, kbuf, size);
+			free (kbuf);
+		}
+
+		sec_no += chunk;
+		buffer = (uint8_t *) buffer + size;
+		cnt -= chunk;
+	}
+}
+
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for DISK_SECTOR_SIZE bytes.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+void
+disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
+	transfer (d, sec_no, buffer, 1, false);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -233,23 +550,30 @@ disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
    per-disk locking is unneeded. */
 void
 disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer) {
-	struct channel *c;
+	transfer (d, sec_no, (void *) buffer, 1, true);
+}
 
-	ASSERT (d != NULL);
-	ASSERT (buffer != NULL);
+/* Reads CNT consecutive sectors, starting at SEC_NO, from disk D
+   into BUFFER, which must have room for CNT * DISK_SECTOR_SIZE
+   bytes.  Much faster than reading them one by one with
+   disk_read(), since up to DISK_TRANSFER_MAX of them go in one
+   command, which interrupts once per READ MULTIPLE block, or
+   once in all with DMA, instead of once per sector. */
+void
+disk_read_multi (struct disk *d, disk_sector_t sec_no, void *buffer,
+		size_t cnt) {
+	transfer (d, sec_no, buffer, cnt, false);
+}
 
-	c = d->channel;
-	lock_acquire (&c->lock);
-	select_sector (d, sec_no);
-	issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-	if (!wait_while_busy (d))
-		PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-	output_sector (c, buffer);
-	sema_down (&c->completion_wait);
-	d->write_cnt++;
-	lock_release (&c->lock);
+/* Writes CNT consecutive sectors, starting at SEC_NO, to disk D
+   from BUFFER, which must contain CNT * DISK_SECTOR_SIZE bytes,
+   as disk_read_multi() reads them. */
+void
+disk_write_multi (struct disk *d, disk_sector_t sec_no, const void *buffer,
+		size_t cnt) {
+	transfer (d, sec_no, (void *) buffer, cnt, true);
 }
-
+
 /* Disk detection and identification. */
 
 static void print_ata_string (char *string, size_t size);
@@ -361,8 +685,24 @@ identify_ata_device (struct disk *d) {
 	}
 	input_sector (c, id);
 
-	/* Calculate capacity. */
+	/* Calculate capacity.  Word 83, bit 10: 48-bit addressing
+	   supported, with the capacity in words 100 through 103.  We
+	   can only address the first 2**32 sectors of such a disk. */
 	d->capacity = id[60] | ((uint32_t) id[61] << 16);
+	d->lba48 = (id[83] & 0xc000) == 0x4000 && (id[83] & (1 << 10)) != 0;
+	if (d->lba48) {
+		if (id[102] != 0 || id[103] != 0)
+			d->capacity = UINT32_MAX;
+		else
+			d->capacity = id[100] | ((uint32_t) id[101] << 16);
+	}
+
+	/* Word 49, bit 8: DMA supported. */
+	d->dma = c->bm_base != 0 && (id[49] & (1 << 8)) != 0;
+
+	/* Word 47, bits 7:0: most sectors per READ/WRITE MULTIPLE
+	   block. */
+	set_multiple_mode (d, id[47] & 0xff);
 
 	/* Print identification message. */
 	printf ("%s: detected %'"PRDSNu" sector (", d->name, d->capacity);
@@ -382,6 +722,33 @@ identify_ata_device (struct disk *d) {
 	printf ("\"\n");
 }
 
+/* Sends a SET MULTIPLE MODE command to disk D, so that READ and
+   WRITE MULTIPLE move MAX sectors per interrupt, and sets D's
+   multiple member to MAX if D accepts it.  Nothing waits on the
+   channel for this command's interrupt, so it is masked with
+   nIEN while we poll for completion instead. */
+static void
+set_multiple_mode (struct disk *d, size_t max) {
+	struct channel *c = d->channel;
+	uint8_t status;
+
+	d->multiple = 0;
+	if (max <= 1)
+		return;
+
+	select_device_wait (d);
+	outb (reg_ctl (c), CTL_NIEN);
+	outb (reg_nsect (c), max);
+	outb (reg_command (c), CMD_SET_MULTIPLE_MODE);
+	timer_ndelay (400);
+	wait_while_busy (d);
+	status = inb (reg_status (c));
+	outb (reg_ctl (c), 0);
+
+	if (!(status & STA_ERR))
+		d->multiple = max;
+}
+
 /* Prints STRING, which consists of SIZE bytes in a funky format:
    each pair of bytes is in reverse order.  Does not print
    trailing whitespace and/or nulls. */
@@ -402,32 +769,68 @@ print_ata_string (char *string, size_t size) {
 }
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
-static void
-select_sector (struct disk *d, disk_sector_t sec_no) {
+   writes SEC_NO and CNT, the number of sectors to transfer, to
+   the disk's sector selection registers.  (We use LBA mode.)
+   Returns true if the transfer reaches past the sectors that 28
+   bits can address, so that the registers were loaded for a
+   48-bit command, which the caller must then issue. */
+static bool
+select_sector (struct disk *d, disk_sector_t sec_no, size_t cnt) {
 	struct channel *c = d->channel;
+	bool lba48 = (uint64_t) sec_no + cnt > (1UL << 28);
 
-	ASSERT (sec_no < d->capacity);
-	ASSERT (sec_no < (1UL << 28));
+	ASSERT (cnt > 0 && cnt <= DISK_TRANSFER_MAX);
+	ASSERT ((uint64_t) sec_no + cnt <= d->capacity);
+	ASSERT (!lba48 || d->lba48);
 
 	select_device_wait (d);
-	outb (reg_nsect (c), 1);
-	outb (reg_lbal (c), sec_no);
-	outb (reg_lbam (c), sec_no >> 8);
-	outb (reg_lbah (c), (sec_no >> 16));
-	outb (reg_device (c),
-			DEV_MBS | DEV_LBA | (d->dev_no == 1 ? DEV_DEV : 0) | (sec_no >> 24));
+	if (lba48) {
+		/* Each register is a two-byte FIFO: high order bytes
+		   first. */
+		outb (reg_nsect (c), cnt >> 8);
+		outb (reg_lbal (c), sec_no >> 24);
+		outb (reg_lbam (c), 0);
+		outb (reg_lbah (c), 0);
+		outb (reg_nsect (c), cnt);
+		outb (reg_lbal (c), sec_no);
+		outb (reg_lbam (c), sec_no >> 8);
+		outb (reg_lbah (c), sec_no >> 16);
+		outb (reg_device (c),
+				DEV_MBS | DEV_LBA | (d->dev_no == 1 ? DEV_DEV : 0));
+	} else {
+		outb (reg_nsect (c), cnt == DISK_TRANSFER_MAX ? 0 : cnt);
+		outb (reg_lbal (c), sec_no);
+		outb (reg_lbam (c), sec_no >> 8);
+		outb (reg_lbah (c), (sec_no >> 16));
+		outb (reg_device (c),
+				DEV_MBS | DEV_LBA | (d->dev_no == 1 ? DEV_DEV : 0) | (sec_no >> 24));
+	}
+	return lba48;
+}
+
+/* Returns the command that transfers sectors on disk D: by DMA
+   if DMA is true, otherwise by PIO, using READ/WRITE MULTIPLE if
+   D supports them; writing if WRITE is true, reading otherwise;
+   and addressing with 48 bits if LBA48 is true. */
+static uint8_t
+transfer_command (const struct disk *d, bool dma, bool write, bool lba48) {
+	if (dma)
+		return (lba48 ? (write ? CMD_WRITE_DMA_EXT : CMD_READ_DMA_EXT)
+				: (write ? CMD_WRITE_DMA : CMD_READ_DMA));
+	else if (d->multiple > 0)
+		return (lba48 ? (write ? CMD_WRITE_MULTIPLE_EXT : CMD_READ_MULTIPLE_EXT)
+				: (write ? CMD_WRITE_MULTIPLE : CMD_READ_MULTIPLE));
+	else
+		return (lba48 ? (write ? CMD_WRITE_SECTOR_EXT : CMD_READ_SECTOR_EXT)
+				: (write ? CMD_WRITE_SECTOR_RETRY : CMD_READ_SECTOR_RETRY));
 }
 
 /* Writes COMMAND to channel C and prepares for receiving a
-   completion interrupt. */
+   completion interrupt.  Interrupts may be off, as they are when
+   a queued request is started, but must be turned on before
+   waiting for the interrupt. */
 static void
 issue_pio_command (struct channel *c, uint8_t command) {
-	/* Interrupts must be enabled or our semaphore will never be
-	   up'd by the completion handler. */
-	ASSERT (intr_get_level () == INTR_ON);
-
 	c->expecting_interrupt = true;
 	outb (reg_command (c), command);
 }
@@ -446,6 +849,417 @@ output_sector (struct channel *c, const void *sector) {
 	outsw (reg_data (c), sector, DISK_SECTOR_SIZE / 2);
 }
 
+/* Bus master DMA. */
+
+/* Reads the 32-bit register at offset REG of the configuration
+   space of PCI device DEV, function FUNC, on bus 0. */
+static uint32_t
+pci_read_config (int dev, int func, int reg) {
+	outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+	return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes VALUE to the 32-bit register at offset REG of the
+   configuration space of PCI device DEV, function FUNC, on bus 0. */
+static void
+pci_write_config (int dev, int func, int reg, uint32_t value) {
+	outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+	outl (PCI_CONFIG_DATA, value);
+}
+
+/* Looks on PCI bus 0 for an IDE controller that can act as a bus
+   master, such as the PIIX found in QEMU and Bochs, and turns on
+   its bus mastering.  Returns the I/O port of its bus master
+   registers, or 0 if there is no such controller. */
+static uint16_t
+find_bus_master (void) {
+	int dev, func;
+
+	for (dev = 0; dev < 32; dev++)
+		for (func = 0; func < 8; func++) {
+			uint32_t id = pci_read_config (dev, func, 0x00);
+			uint32_t class = pci_read_config (dev, func, 0x08);
+			uint32_t bar4;
+
+			if ((id & 0xffff) == 0xffff)
+				continue;
+
+			/* Class 01h (mass storage), subclass 01h (IDE),
+			   programming interface bit 7 (bus master capable). */
+			if ((class >> 16) != 0x0101 || (class & 0x8000) == 0)
+				continue;
+
+			/* BAR4 must be an I/O space address. */
+			bar4 = pci_read_config (dev, func, 0x20);
+			if ((bar4 & 1) == 0 || (bar4 & ~3u) == 0)
+				continue;
+
+			/* Enable I/O space and bus mastering. */
+			pci_write_config (dev, func, 0x04,
+					pci_read_config (dev, func, 0x04) | 0x5);
+			return bar4 & 0xfffc;
+		}
+	return 0;
+}
+
+/* Starts bus master DMA for the batch on channel C: the
+   controller, not the CPU, moves the data to or from the
+   requests' buffers, which it gathers from one descriptor each.
+   Returns false, having done nothing, if the batch's disk cannot
+   use DMA or a buffer is unsuitable; the caller then uses PIO.
+   Must be called with interrupts off. */
+static bool
+dma_start (struct channel *c) {
+	struct disk_request *first = list_entry (list_front (&c->batch),
+			struct disk_request, elem);
+	struct list_elem *e;
+	size_t cnt = 0, n = 0;
+	bool lba48;
+
+	if (!first->disk->dma)
+		return false;
+
+	/* Describe each buffer, splitting it at 64 kB boundaries.  A
+	   buffer must be word aligned and, since PRD addresses are 32
+	   bits, lie in the first 4 GB of physical memory.  The kernel
+	   maps physical memory contiguously, so a kernel buffer is
+	   physically contiguous too.  DISK_TRANSFER_MAX sectors need
+	   at most two descriptors per sector, which a page holds. */
+	for (e = list_begin (&c->batch); e != list_end (&c->batch);
+			e = list_next (e)) {
+		struct disk_request *r = list_entry (e, struct disk_request, elem);
+		size_t left = r->cnt * DISK_SECTOR_SIZE;
+		uint64_t pa = vtop (r->buffer);
+
+		if (((uintptr_t) r->buffer & 1) || pa + left > 0x100000000ULL)
+			return false;
+		while (left > 0) {
+			size_t size = 0x10000 - (pa & 0xffff);
+			if (size > left)
+				size = left;
+			c->prdt[n].addr = pa;
+			c->prdt[n].size = size & 0xffff;
+			c->prdt[n].flags = 0;
+			pa += size;
+			left -= size;
+			n++;
+		}
+		cnt += r->cnt;
+	}
+	c->prdt[n - 1].flags = PRD_EOT;
+
+	/* Program the bus master, issue the command, then start. */
+	c->dma = true;
+	outl (reg_bm_prdt (c), vtop (c->prdt));
+	outb (reg_bm_command (c), first->write ? 0 : BM_CMD_READ);
+	outb (reg_bm_status (c), BM_STA_ERR | BM_STA_INTR);
+	lba48 = select_sector (first->disk, first->sec_no, cnt);
+	issue_pio_command (c,
+			transfer_command (first->disk, true, first->write, lba48));
+	outb (reg_bm_command (c), (first->write ? 0 : BM_CMD_READ) | BM_CMD_START);
+	return true;
+}
+
+/* Stops the bus master after the DMA batch on channel C has
+   raised its completion interrupt.  Returns true if the transfer
+   succeeded.  On failure, turns DMA off for the batch's disk and
+   returns false. */
+static bool
+dma_finish (struct channel *c) {
+	struct disk_request *first = list_entry (list_front (&c->batch),
+			struct disk_request, elem);
+	uint8_t bm_status, status;
+
+	outb (reg_bm_command (c), first->write ? 0 : BM_CMD_READ);
+	bm_status = inb (reg_bm_status (c));
+	outb (reg_bm_status (c), BM_STA_ERR | BM_STA_INTR);
+	status = inb (reg_alt_status (c));
+	c->dma = false;
+	if ((bm_status & BM_STA_ERR) || (status & (STA_ERR | STA_BSY))) {
+		printf ("%s: DMA failed, sector=%"PRDSNu", using PIO\n",
+				first->disk->name, first->sec_no);
+		first->disk->dma = false;
+		return false;
+	}
+	return true;
+}
+
+/* Returns the key by which schedule() orders request R: its
+   position on the channel, taking the master's sectors before
+   the slave's. */
+static uint64_t
+request_key (const struct disk_request *r) {
+	return ((uint64_t) r->disk->dev_no << 32) | r->sec_no;
+}
+
+/* Picks the requests for channel C's next command and moves them
+   from C's queue to its batch.
+
+   Requests are taken in C-LOOK order: the one with the lowest key
+   at or past where the last batch ended, or the lowest of all
+   once there is none past it, so the heads sweep across the disk
+   in one direction.  A request whose deadline has passed goes
+   first, though.  Reads get a much shorter deadline than writes,
+   so a flood of write-back cannot hold up a reader for long.
+
+   Queued requests that continue the chosen one, on the same disk
+   in the same direction, join the batch, up to DISK_TRANSFER_MAX
+   sectors in all. */
+static void
+schedule (struct channel *c) {
+	struct disk_request *next = NULL, *lowest = NULL, *urgent = NULL;
+	struct disk_request *first;
+	struct list_elem *e;
+	disk_sector_t end;
+	size_t cnt;
+
+	ASSERT (list_empty (&c->batch));
+	ASSERT (!list_empty (&c->queue));
+
+	for (e = list_begin (&c->queue); e != list_end (&c->queue);
+			e = list_next (e)) {
+		struct disk_request *r = list_entry (e, struct disk_request, elem);
+		uint64_t key = request_key (r);
+
+		if (urgent == NULL || r->deadline < urgent->deadline)
+			urgent = r;
+		if (key >= c->head && (next == NULL || key < request_key (next)))
+			next = r;
+		if (lowest == NULL || key < request_key (lowest))
+			lowest = r;
+	}
+	if (urgent->deadline <= timer_ticks ())
+		first = urgent;
+	else
+		first = next != NULL ? next : lowest;
+
+	list_remove (&first->elem);
+	list_push_back (&c->batch, &first->elem);
+	end = first->sec_no + first->cnt;
+	cnt = first->cnt;
+
+	/* Merge requests that start where the batch ends. */
+	for (e = list_begin (&c->queue); e != list_end (&c->queue); ) {
+		struct disk_request *r = list_entry (e, struct disk_request, elem);
+
+		if (r->disk == first->disk && r->write == first->write
+				&& r->sec_no == end && cnt + r->cnt <= DISK_TRANSFER_MAX) {
+			list_remove (e);
+			list_push_back (&c->batch, &r->elem);
+			end += r->cnt;
+			cnt += r->cnt;
+
+			/* A later request may now continue the batch. */
+			e = list_begin (&c->queue);
+		} else
+			e = list_next (e);
+	}
+	c->head = ((uint64_t) first->disk->dev_no << 32) | end;
+}
+
+/* Returns the address of the sector that the PIO transfer on
+   channel C moves next. */
+static uint8_t *
+pio_sector (struct channel *c) {
+	return (uint8_t *) c->cur->buffer + c->cur->done_cnt * DISK_SECTOR_SIZE;
+}
+
+/* Counts a sector of the PIO transfer on channel C as moved.
+   Returns true if the batch has more sectors to move. */
+static bool
+pio_advance (struct channel *c) {
+	if (++c->cur->done_cnt == c->cur->cnt) {
+		struct list_elem *e = list_next (&c->cur->elem);
+		if (e == list_end (&c->batch))
+			return false;
+		c->cur = list_entry (e, struct disk_request, elem);
+	}
+	return true;
+}
+
+/* Moves the next block of the PIO transfer on channel C, out to
+   the disk if WRITE is true, in from it otherwise: as many
+   sectors as the disk moves per interrupt, or as many as are
+   left.  Returns true if the batch has more sectors to move. */
+static bool
+pio_block (struct channel *c, bool write) {
+	size_t n = c->cur->disk->multiple > 0 ? c->cur->disk->multiple : 1;
+
+	while (n-- > 0) {
+		if (write)
+			output_sector (c, pio_sector (c));
+		else
+			input_sector (c, pio_sector (c));
+		if (!pio_advance (c))
+			return false;
+	}
+	return true;
+}
+
+/* Starts the command for the batch on channel C, by DMA if
+   possible and by PIO otherwise.  Must be called with interrupts
+   off. */
+static void
+issue_batch (struct channel *c) {
+	struct disk_request *first = list_entry (list_front (&c->batch),
+			struct disk_request, elem);
+	struct disk *d = first->disk;
+	struct list_elem *e;
+	size_t cnt = 0;
+	bool lba48;
+
+	for (e = list_begin (&c->batch); e != list_end (&c->batch);
+			e = list_next (e)) {
+		struct disk_request *r = list_entry (e, struct disk_request, elem);
+		r->done_cnt = 0;
+		cnt += r->cnt;
+	}
+	c->cur = first;
+
+	if (dma_start (c))
+		return;
+
+	lba48 = select_sector (d, first->sec_no, cnt);
+	issue_pio_command (c, transfer_command (d, false, first->write, lba48));
+	if (first->write) {
+		/* The disk asks for each block in turn: the first without
+		   an interrupt, the rest as each one's interrupt arrives.
+		   It is usually ready for the first at once.  If not, the
+		   PIO thread waits for it, since this may be running in
+		   the interrupt handler. */
+		timer_ndelay (400);
+		if (drq_ready (c))
+			pio_block (c, true);
+		else {
+			c->drq_wait = true;
+			sema_up (&c->drq_sema);
+		}
+	}
+}
+
+/* Starts the next command on channel C, if C is idle and has
+   requests queued.  Must be called with interrupts off. */
+static void
+start_request (struct channel *c) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (!list_empty (&c->batch) || list_empty (&c->queue))
+		return;
+	schedule (c);
+	issue_batch (c);
+}
+
+/* Handles an interrupt for the batch on channel C, given the
+   STATUS read to acknowledge it.  Moves the next sector of a PIO
+   transfer, or completes the batch's requests and starts the next
+   command. */
+static void
+service_request (struct channel *c, uint8_t status) {
+	struct disk_request *r = c->cur;
+
+	if (c->drq_wait)
+		return;     /* The PIO thread has the batch. */
+
+	if (c->dma) {
+		if (!dma_finish (c)) {
+			/* Start over, by PIO this time. */
+			issue_batch (c);
+			return;
+		}
+	} else if (r->write) {
+		/* The interrupt acknowledges a block we sent.  Sectors are
+		   left if the request holding the next one is not done, and
+		   then the disk asks for them by setting DRQ. */
+		if (status & STA_ERR) {
+			fail_batch (c);
+			return;
+		}
+		if (r->done_cnt < r->cnt) {
+			if ((status & (STA_BSY | STA_DRQ)) != STA_DRQ)
+				fail_batch (c);
+			else
+				pio_block (c, true);
+			return;
+		}
+	} else {
+		/* The interrupt announces a block for us to read. */
+		if ((status & (STA_BSY | STA_DRQ | STA_ERR)) != STA_DRQ) {
+			fail_batch (c);
+			return;
+		}
+		if (pio_block (c, false))
+			return;
+	}
+	complete_batch (c, false);
+}
+
+/* Completes the requests of the batch on channel C, as failed if
+   ERROR is true, and starts the next command.  Must be called with
+   interrupts off. */
+static void
+complete_batch (struct channel *c, bool error) {
+	struct disk *d = c->cur->disk;
+	struct disk_request *r;
+
+	/* Wake each request's waiter before calling back, since the
+	   callback may free the request. */
+	while (!list_empty (&c->batch)) {
+		r = list_entry (list_pop_front (&c->batch), struct disk_request, elem);
+		r->error = error;
+		if (!error) {
+			if (r->write)
+				d->write_cnt += r->cnt;
+			else
+				d->read_cnt += r->cnt;
+		}
+		record_complete (d, r);
+		sema_up (&r->done);
+		if (r->func != NULL)
+			r->func (r, r->aux);
+	}
+	c->cur = NULL;
+	c->expecting_interrupt = false;
+	start_request (c);
+}
+
+/* Reports that the command for the batch on channel C failed at
+   the sector it was about to move, and completes the batch's
+   requests as failed.  Must be called with interrupts off. */
+static void
+fail_batch (struct channel *c) {
+	struct disk_request *r = c->cur;
+
+	printf ("%s: disk %s failed, sector=%"PRDSNu"\n", r->disk->name,
+			r->write ? "write" : "read",
+			(disk_sector_t) (r->sec_no + r->done_cnt));
+	complete_batch (c, true);
+}
+
+/* PIO thread for channel C_.  Sends the first block of a PIO write
+   once the disk asks for it, for writes that issue_batch() could
+   not send at once.  Waiting here, with interrupts on, keeps the
+   interrupt handler from polling the disk. */
+static void
+pio_thread (void *c_) {
+	struct channel *c = c_;
+
+	for (;;) {
+		enum intr_level old_level;
+		bool ready;
+
+		sema_down (&c->drq_sema);
+		ready = wait_for_drq (c->cur->disk);
+
+		old_level = intr_disable ();
+		c->drq_wait = false;
+		if (ready)
+			pio_block (c, true);
+		else
+			fail_batch (c);
+		intr_set_level (old_level);
+	}
+}
+
 /* Low-level ATA primitives. */
 
 /* Wait up to 10 seconds for the controller to become idle, that
@@ -460,7 +1274,7 @@ wait_until_idle (const struct disk *d) {
 	for (i = 0; i < 1000; i++) {
 		if ((inb (reg_status (d->channel)) & (STA_BSY | STA_DRQ)) == 0)
 			return;
-		timer_usleep (10);
+		timer_udelay (10);
 	}
 
 	printf ("%s: idle timeout\n", d->name);
@@ -490,6 +1304,41 @@ wait_while_busy (const struct disk *d) {
 	return false;
 }
 
+/* Returns true if the disk selected on channel C has cleared BSY
+   and set DRQ, as it does when it is ready for the next block of
+   a PIO write. */
+static bool
+drq_ready (const struct channel *c) {
+	return (inb (reg_alt_status (c)) & (STA_BSY | STA_DRQ)) == STA_DRQ;
+}
+
+/* Waits up to 30 seconds, as wait_while_busy() does, for disk D to
+   become ready for the next block of a PIO write, polling every
+   10 us for the first millisecond and then sleeping between polls.
+   Returns true if it did, false if it timed out or reported an
+   error.  Must be called with interrupts on. */
+static bool
+wait_for_drq (const struct disk *d) {
+	struct channel *c = d->channel;
+	int i;
+
+	ASSERT (intr_get_level () == INTR_ON);
+
+	for (i = 0; i < 100 + 3000; i++) {
+		uint8_t status = inb (reg_alt_status (c));
+
+		if ((status & (STA_BSY | STA_ERR)) == STA_ERR)
+			return false;
+		if ((status & (STA_BSY | STA_DRQ)) == STA_DRQ)
+			return true;
+		if (i < 100)
+			timer_udelay (10);
+		else
+			timer_msleep (10);
+	}
+	return false;
+}
+
 /* Program D's channel so that D is now the selected disk. */
 static void
 select_device (const struct disk *d) {
@@ -499,7 +1348,7 @@ select_device (const struct disk *d) {
 		dev |= DEV_DEV;
 	outb (reg_device (c), dev);
 	inb (reg_alt_status (c));
-	timer_nsleep (400);
+	timer_ndelay (400);
 }
 
 /* Select disk D in its channel, as select_device(), but wait for
@@ -519,8 +1368,11 @@ interrupt_handler (struct intr_frame *f) {
 	for (c = channels; c < channels + CHANNEL_CNT; c++)
 		if (f->vec_no == c->irq) {
 			if (c->expecting_interrupt) {
-				inb (reg_status (c));               /* Acknowledge interrupt. */
-				sema_up (&c->completion_wait);      /* Wake up waiter. */
+				uint8_t status = inb (reg_status (c));  /* Acknowledge interrupt. */
+				if (!list_empty (&c->batch))
+					service_request (c, status);    /* Queued request. */
+				else
+					sema_up (&c->completion_wait);  /* Wake up waiter. */
 			} else
 				printf ("%s: unexpected interrupt\n", c->name);
 			return;
@@ -529,16 +1381,34 @@ interrupt_handler (struct intr_frame *f) {
 	NOT_REACHED ();
 }
 
+/* Returns the disk that user RDX and RCX name, or a null pointer
+   if they do not name one. */
+static struct disk *
+inspect_disk (struct intr_frame *f) {
+	if (f->R.rdx >= CHANNEL_CNT || f->R.rcx > 1)
+		return NULL;
+	return disk_get (f->R.rdx, f->R.rcx);
+}
+
 static void
 inspect_read_cnt (struct intr_frame *f) {
-	struct disk * d = disk_get (f->R.rdx, f->R.rcx);
-	f->R.rax = d->read_cnt;
+	struct disk * d = inspect_disk (f);
+	f->R.rax = d != NULL ? d->read_cnt : 0;
 }
 
 static void
 inspect_write_cnt (struct intr_frame *f) {
-	struct disk * d = disk_get (f->R.rdx, f->R.rcx);
-	f->R.rax = d->write_cnt;
+	struct disk * d = inspect_disk (f);
+	f->R.rax = d != NULL ? d->write_cnt : 0;
+}
+
+static void
+inspect_stat (struct intr_frame *f) {
+	struct disk * d = inspect_disk (f);
+	if (d != NULL && f->R.rdi < sizeof d->stats / sizeof (uint64_t))
+		f->R.rax = ((uint64_t *) &d->stats)[f->R.rdi];
+	else
+		f->R.rax = 0;
 }
 
 /* Tool for testing disk r/w cnt. Calling this function via int 0x43 and int 0x44.
@@ -546,9 +1416,13 @@ inspect_write_cnt (struct intr_frame *f) {
  *   @RDX - chan_no of disk to inspect
  *   @RCX - dev_no of disk to inspect
  * Output:
- *   @RAX - Read/Write count of disk. */
+ *   @RAX - Read/Write count of disk, or 0 if there is no such disk.
+ *
+ * int 0x45 returns any member of the disk's struct disk_stats:
+ * RDI holds its index, counting uint64_t's from the start. */
 void
 register_disk_inspect_intr (void) {
 	intr_register_int (0x43, 3, INTR_OFF, inspect_read_cnt, "Inspect Disk Read Count");
 	intr_register_int (0x44, 3, INTR_OFF, inspect_write_cnt, "Inspect Disk Write Count");
+	intr_register_int (0x45, 3, INTR_OFF, inspect_stat, "Inspect Disk Statistics");
 }
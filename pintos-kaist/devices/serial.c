@@ -1,7 +1,7 @@
 #include "devices/serial.h"
 #include <debug.h>
+#include <string.h>
 #include "devices/input.h"
-#include "devices/intq.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
@@ -33,6 +33,14 @@
 #define MCR_REG (IO_BASE + 4)   /* MODEM Control Register. */
 #define LSR_REG (IO_BASE + 5)   /* Line Status Register (read-only). */
 
+/* FIFO Control Register bits. */
+#define FCR_ENABLE 0x01         /* Enable receive and transmit FIFOs. */
+#define FCR_CLEAR_RECV 0x02     /* Clear receive FIFO. */
+#define FCR_CLEAR_XMIT 0x04     /* Clear transmit FIFO. */
+
+/* Interrupt Identification Register bits. */
+#define IIR_FIFO 0xc0           /* Both set if FIFOs are enabled. */
+
 /* Interrupt Enable Register bits. */
 #define IER_RECV 0x01           /* Interrupt when data received. */
 #define IER_XMIT 0x02           /* Interrupt when transmit finishes. */
@@ -51,11 +59,37 @@
 /* Transmission mode. */
 static enum { UNINIT, POLL, QUEUE } mode;
 
-/* Data to be transmitted. */
-static struct intq txq;
+/* Data to be transmitted, in a ring buffer.  Bytes from TX_TAIL
+   up to TX_HEAD are waiting to go out; both indexes only ever
+   increase and are reduced modulo TXQ_SIZE on access.
+
+   Producers append with interrupts disabled, which on our single
+   CPU also serializes them against each other, and only ever
+   advance TX_HEAD.  Consumers, normally serial_interrupt() and
+   otherwise the polling fallbacks, only ever advance TX_TAIL, so
+   a producer never waits on the hardware unless the ring is
+   full. */
+#define TXQ_SIZE 16384          /* Must be a power of 2. */
+static uint8_t txq[TXQ_SIZE];
+static volatile size_t tx_head, tx_tail;
+
+/* Threads waiting for room in a full TXQ, and the semaphore
+   serial_interrupt() wakes them with. */
+static struct semaphore tx_room;
+static int tx_waiters;
+
+/* Number of bytes the transmitter accepts at once once its
+   holding register goes empty: 16 with the 16550A FIFO enabled,
+   otherwise 1. */
+static size_t tx_fifo_size;
+
+/* Last value written to the interrupt enable register. */
+static uint8_t ier_value;
 
 static void set_serial (int bps);
 static void putc_poll (uint8_t);
+static void drain_poll (void);
+static size_t drain_fifo (void);
 static void write_ier (void);
 static intr_handler_func serial_interrupt;
 
@@ -67,10 +101,12 @@ static void
 init_poll (void) {
 	ASSERT (mode == UNINIT);
 	outb (IER_REG, 0);                    /* Turn off all interrupts. */
-	outb (FCR_REG, 0);                    /* Disable FIFO. */
+	ier_value = 0;
+	outb (FCR_REG, FCR_ENABLE | FCR_CLEAR_RECV | FCR_CLEAR_XMIT);
+	tx_fifo_size = (inb (IIR_REG) & IIR_FIFO) == IIR_FIFO ? 16 : 1;
 	set_serial (115200);                  /* 115.2 kbps, N-8-1. */
 	outb (MCR_REG, MCR_OUT2);             /* Required to enable interrupts. */
-	intq_init (&txq);
+	tx_head = tx_tail = 0;
 	mode = POLL;
 }
 
@@ -85,6 +121,7 @@ serial_init_queue (void) {
 		init_poll ();
 	ASSERT (mode == POLL);
 
+	sema_init (&tx_room, 0);
 	intr_register_ext (0x20 + 4, serial_interrupt, "serial");
 	mode = QUEUE;
 	old_level = intr_disable ();
@@ -95,28 +132,55 @@ serial_init_queue (void) {
 /* Sends BYTE to the serial port. */
 void
 serial_putc (uint8_t byte) {
+	serial_putbuf (&byte, 1);
+}
+
+/* Sends the N bytes in BUFFER to the serial port. */
+void
+serial_putbuf (const void *buffer, size_t n) {
+	const uint8_t *src = buffer;
 	enum intr_level old_level = intr_disable ();
 
 	if (mode != QUEUE) {
 		/* If we're not set up for interrupt-driven I/O yet,
-		   use dumb polling to transmit a byte. */
+		   use dumb polling to transmit. */
 		if (mode == UNINIT)
 			init_poll ();
-		putc_poll (byte);
+		while (n-- > 0)
+			putc_poll (*src++);
 	} else {
-		/* Otherwise, queue a byte and update the interrupt enable
-		   register. */
-		if (old_level == INTR_OFF && intq_full (&txq)) {
-			/* Interrupts are off and the transmit queue is full.
-			   If we wanted to wait for the queue to empty,
-			   we'd have to reenable interrupts.
-			   That's impolite, so we'll send a character via
-			   polling instead. */
-			putc_poll (intq_getc (&txq));
+		/* Otherwise, copy as much as fits into the queue and update
+		   the interrupt enable register. */
+		while (n > 0) {
+			size_t room = TXQ_SIZE - (tx_head - tx_tail);
+			size_t ofs = tx_head % TXQ_SIZE;
+			size_t chunk;
+
+			if (room == 0) {
+				if (old_level == INTR_ON && !intr_context ()) {
+					/* Wait for serial_interrupt() to make room. */
+					tx_waiters++;
+					sema_down (&tx_room);
+				} else {
+					/* Interrupts are off.  If we wanted to wait for
+					   the queue to empty, we'd have to reenable
+					   interrupts.  That's impolite, so we'll send a
+					   burst via polling instead. */
+					drain_poll ();
+				}
+				continue;
+			}
+
+			chunk = n < room ? n : room;
+			if (chunk > TXQ_SIZE - ofs)
+				chunk = TXQ_SIZE - ofs;
+			memcpy (txq + ofs, src, chunk);
+			barrier ();
+			tx_head += chunk;
+			src += chunk;
+			n -= chunk;
+			write_ier ();
 		}
-
-		intq_putc (&txq, byte);
-		write_ier ();
 	}
 
 	intr_set_level (old_level);
@@ -127,8 +191,10 @@ serial_putc (uint8_t byte) {
 void
 serial_flush (void) {
 	enum intr_level old_level = intr_disable ();
-	while (!intq_empty (&txq))
-		putc_poll (intq_getc (&txq));
+	while (tx_head != tx_tail)
+		drain_poll ();
+	if (mode == QUEUE)
+		write_ier ();
 	intr_set_level (old_level);
 }
 
@@ -171,7 +237,7 @@ write_ier (void) {
 
 	/* Enable transmit interrupt if we have any characters to
 	   transmit. */
-	if (!intq_empty (&txq))
+	if (tx_head != tx_tail)
 		ier |= IER_XMIT;
 
 	/* Enable receive interrupt if we have room to store any
@@ -179,7 +245,12 @@ write_ier (void) {
 	if (!input_full ())
 		ier |= IER_RECV;
 
-	outb (IER_REG, ier);
+	/* Port I/O is slow, especially under a virtual machine, so
+	   skip the write if nothing changed. */
+	if (ier != ier_value) {
+		outb (IER_REG, ier);
+		ier_value = ier;
+	}
 }
 
 /* Polls the serial port until it's ready,
@@ -193,6 +264,34 @@ putc_poll (uint8_t byte) {
 	outb (THR_REG, byte);
 }
 
+/* Polls the serial port until it's ready, and then transmits a
+   burst of queued bytes. */
+static void
+drain_poll (void) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	while ((inb (LSR_REG) & LSR_THRE) == 0)
+		continue;
+	drain_fifo ();
+}
+
+/* Moves as many queued bytes as the transmitter can take into
+   it, which must already have signaled THR empty.  Returns the
+   number of bytes moved. */
+static size_t
+drain_fifo (void) {
+	size_t n = tx_head - tx_tail;
+	size_t i;
+
+	if (n > tx_fifo_size)
+		n = tx_fifo_size;
+	for (i = 0; i < n; i++)
+		outb (THR_REG, txq[(tx_tail + i) % TXQ_SIZE]);
+	barrier ();
+	tx_tail += n;
+	return n;
+}
+
 /* Serial interrupt handler. */
 static void
 serial_interrupt (struct intr_frame *f UNUSED) {
@@ -205,10 +304,16 @@ serial_interrupt (struct intr_frame *f UNUSED) {
 	while (!input_full () && (inb (LSR_REG) & LSR_DR) != 0)
 		input_putc (inb (RBR_REG));
 
-	/* As long as we have a byte to transmit, and the hardware is
-	   ready to accept a byte for transmission, transmit a byte. */
-	while (!intq_empty (&txq) && (inb (LSR_REG) & LSR_THRE) != 0)
-		outb (THR_REG, intq_getc (&txq));
+	/* If we have bytes to transmit, and the hardware is ready to
+	   accept them, refill its whole FIFO at once. */
+	if (tx_head != tx_tail && (inb (LSR_REG) & LSR_THRE) != 0)
+		drain_fifo ();
+
+	/* Wake up writers waiting for room once half the queue has
+	   drained, rather than once per burst. */
+	if (tx_waiters > 0 && tx_head - tx_tail <= TXQ_SIZE / 2)
+		for (; tx_waiters > 0; tx_waiters--)
+			sema_up (&tx_room);
 
 	/* Update interrupt enable register based on queue status. */
 	write_ier ();
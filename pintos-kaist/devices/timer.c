@@ -1,12 +1,16 @@
 #include "devices/timer.h"
+#include <clock.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stdio.h>
 #include "threads/interrupt.h"
 #include "threads/io.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
+#include "intrinsic.h"
 
 /* See [8254] for hardware details of the 8254 timer chip. */
 
@@ -17,30 +21,74 @@
 #error TIMER_FREQ <= 1000 recommended
 #endif
 
+/* 8254 input frequency, in cycles per second. */
+#define PIT_HZ 1193180
+
+/* PIT cycles per timer tick, rounded to nearest. */
+#define TICK_CYCLES ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* Range of counts we start the PIT with.  Shorter than the
+   minimum is not worth an interrupt. */
+#define PIT_MIN_COUNT 16
+#define PIT_MAX_COUNT 0xffff
+
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* The PIT runs in one-shot mode: each interrupt programs the
+   next one, at the next tick boundary if some thread is running,
+   but only when a sleeper is due while the CPU is idle, so that
+   an idle CPU is not woken TIMER_FREQ times a second for
+   nothing.  Time is kept in PIT cycles since boot.  These
+   variables are accessed with interrupts off. */
+static int64_t pit_start;       /* Cycle at which the PIT was started. */
+static uint16_t pit_count;      /* Count it was started with. */
+static int64_t next_tick;       /* Cycle at which tick TICKS + 1 begins. */
+static bool tickless;           /* Idle with the tick stopped? */
+static int64_t interrupt_cnt;   /* Number of timer interrupts. */
+
+/* A thread in timer_usleep() or timer_nsleep() for less than a
+   tick.  The PIT is programmed to interrupt at its deadline. */
+struct hires_sleeper {
+	struct list_elem elem;      /* Element in hires_list. */
+	int64_t deadline;           /* Cycle to wake up at. */
+	struct semaphore sema;      /* Up'd at the deadline. */
+};
+
+/* Sub-tick sleepers, earliest deadline first. */
+static struct list hires_list;
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* Ticks over which timer_calibrate() times the TSC. */
+#define TSC_CALIBRATE_TICKS 5
+
+/* TSC calibration, in a page that user processes map too.
+   Initialized by timer_calibrate(). */
+static struct clock_page *clock_page;
+
 static intr_handler_func timer_interrupt;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
+static void real_time_delay (int64_t num, int32_t denom);
+static void pit_start_count (int64_t now, int64_t deadline);
+static int64_t pit_now (void);
+static void advance (int64_t now);
+static void arm (int64_t now);
+static void hires_sleep (int64_t cycles);
+static void calibrate_tsc (void);
 
 /* Sets up the 8254 Programmable Interval Timer (PIT) to
-   interrupt PIT_FREQ times per second, and registers the
-   corresponding interrupt. */
+   interrupt at the first tick, and registers the corresponding
+   interrupt. */
 void
 timer_init (void) {
-	/* 8254 input frequency divided by TIMER_FREQ, rounded to
-	   nearest. */
-	uint16_t count = (1193180 + TIMER_FREQ / 2) / TIMER_FREQ;
-
-	outb (0x43, 0x34);    /* CW: counter 0, LSB then MSB, mode 2, binary. */
-	outb (0x40, count & 0xff);
-	outb (0x40, count >> 8);
+	list_init (&hires_list);
+	next_tick = TICK_CYCLES;
+	pit_start_count (0, next_tick);
 
 	intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
@@ -68,6 +116,32 @@ timer_calibrate (void) {
 			loops_per_tick |= test_bit;
 
 	printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
+
+	calibrate_tsc ();
+}
+
+/* Returns the number of nanoseconds since the OS booted, by the
+   time stamp counter.  Much finer than timer_ticks(), and cheap
+   enough to call anywhere, even with interrupts off.  Returns 0
+   until timer_calibrate() has run. */
+uint64_t
+clock_monotonic (void) {
+	return clock_page != NULL ? clock_page_ns (clock_page, rdtsc ()) : 0;
+}
+
+/* Returns the number of nanoseconds that CYCLES time stamp
+   counter cycles take, or 0 before timer_calibrate(). */
+uint64_t
+clock_cycles_to_ns (uint64_t cycles) {
+	return clock_page != NULL ? clock_mul_shift32 (cycles, clock_page->mult) : 0;
+}
+
+/* Returns the kernel address of the clock page, for mapping into
+   user processes at CLOCK_PAGE, or a null pointer before
+   timer_calibrate(). */
+void *
+timer_clock_page (void) {
+	return clock_page;
 }
 
 /* Returns the number of timer ticks since the OS booted. */
@@ -114,20 +188,225 @@ timer_nsleep (int64_t ns) {
 	real_time_sleep (ns, 1000 * 1000 * 1000);
 }
 
+/* Busy-waits for approximately US microseconds.  Interrupts need
+   not be turned on.
+
+   Busy waiting wastes CPU cycles, and busy waiting with
+   interrupts off for the interval between timer ticks or longer
+   will cause timer ticks to be lost.  Thus, use timer_usleep()
+   instead if interrupts are enabled. */
+void
+timer_udelay (int64_t us) {
+	real_time_delay (us, 1000 * 1000);
+}
+
+/* Busy-waits for approximately NS nanoseconds.  Interrupts need
+   not be turned on.  See timer_udelay(). */
+void
+timer_ndelay (int64_t ns) {
+	real_time_delay (ns, 1000 * 1000 * 1000);
+}
+
+/* Called by the idle thread, with interrupts off, just before
+   it halts the CPU.  Stops the tick until the next sleeper is
+   due. */
+void
+timer_idle_enter (void) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	tickless = true;
+	arm (pit_now ());
+}
+
+/* Called by the idle thread, with interrupts off, when the CPU
+   wakes up from halting.  Accounts for the ticks that passed
+   without an interrupt, as idle time, and restarts the tick. */
+void
+timer_idle_exit (void) {
+	int64_t now;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (!tickless)
+		return;
+	tickless = false;
+	now = pit_now ();
+	advance (now);
+	arm (now);
+}
+
 /* Prints timer statistics. */
 void
 timer_print_stats (void) {
 	printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
+	printf ("Timer: %"PRId64" interrupts\n", interrupt_cnt);
 }
 
 /* Timer interrupt handler. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED) {
-	ticks++;
-	thread_tick ();
-	thread_wakeup(ticks);
-	if (thread_mlfqs)
-		mlfqs_on_tick();
+	int64_t now = pit_now ();
+
+	interrupt_cnt++;
+	advance (now);
+	thread_wakeup (ticks);
+	while (!list_empty (&hires_list)) {
+		struct hires_sleeper *s = list_entry (list_front (&hires_list),
+				struct hires_sleeper, elem);
+		if (s->deadline > now)
+			break;
+		list_pop_front (&hires_list);
+		sema_up (&s->sema);
+	}
+	arm (now);
+}
+
+/* Counts the ticks that have begun by cycle NOW.  Runs
+   thread_tick() for each, so that a stretch of idle time counts
+   as many ticks as if the tick had never stopped.  Sleepers are
+   left for the caller to wake. */
+static void
+advance (int64_t now) {
+	while (next_tick <= now) {
+		ticks++;
+		next_tick += TICK_CYCLES;
+		thread_tick ();
+		if (thread_mlfqs)
+			mlfqs_on_tick ();
+	}
+}
+
+/* Programs the PIT, at cycle NOW, for the next interrupt we need:
+   the next tick boundary, or, when tickless, the start of the
+   tick at which the next sleeper wakes; or a sub-tick sleeper's
+   deadline, if that is sooner. */
+static void
+arm (int64_t now) {
+	int64_t deadline = next_tick;
+
+	if (tickless) {
+		int64_t wakeup = thread_next_wakeup ();
+		if (wakeup == INT64_MAX)
+			deadline = now + PIT_MAX_COUNT;
+		else if (wakeup > ticks + 1)
+			deadline = next_tick + (wakeup - ticks - 1) * TICK_CYCLES;
+	}
+	if (!list_empty (&hires_list)) {
+		struct hires_sleeper *s = list_entry (list_front (&hires_list),
+				struct hires_sleeper, elem);
+		if (s->deadline < deadline)
+			deadline = s->deadline;
+	}
+	pit_start_count (now, deadline);
+}
+
+/* Starts the PIT counting down, at cycle NOW, so that it
+   interrupts at cycle DEADLINE, or as close to it as the range of
+   counts allows. */
+static void
+pit_start_count (int64_t now, int64_t deadline) {
+	int64_t count = deadline - now;
+
+	if (count < PIT_MIN_COUNT)
+		count = PIT_MIN_COUNT;
+	if (count > PIT_MAX_COUNT)
+		count = PIT_MAX_COUNT;
+	pit_start = now;
+	pit_count = count;
+
+	outb (0x43, 0x30);    /* CW: counter 0, LSB then MSB, mode 0, binary. */
+	outb (0x40, count & 0xff);
+	outb (0x40, count >> 8);
+}
+
+/* Returns the number of PIT cycles since boot.  After reaching
+   zero, the counter keeps counting down from 0xffff, so this is
+   right as long as the interrupt is handled within 0x10000
+   cycles, about 55 ms, of its deadline.  Must be called with
+   interrupts off. */
+static int64_t
+pit_now (void) {
+	uint16_t counter;
+
+	outb (0x43, 0x00);    /* CW: counter 0, latch. */
+	counter = inb (0x40);
+	counter |= inb (0x40) << 8;
+	return pit_start + (uint16_t) (pit_count - counter);
+}
+
+/* Measures the TSC's frequency against the PIT, which has a known
+   one, over TSC_CALIBRATE_TICKS ticks, and fills in the clock
+   page. */
+static void
+calibrate_tsc (void) {
+	enum intr_level old_level;
+	int64_t start, pit0, pit1;
+	uint64_t tsc0, tsc1, hz;
+	struct clock_page *cp;
+
+	printf ("Calibrating TSC...  ");
+
+	/* Wait for a tick to start, so that the interval is not
+	   stretched by a timer interrupt at one end only. */
+	start = timer_ticks ();
+	while (timer_ticks () == start)
+		barrier ();
+
+	old_level = intr_disable ();
+	pit0 = pit_now ();
+	tsc0 = rdtsc ();
+	intr_set_level (old_level);
+
+	start = timer_ticks ();
+	while (timer_elapsed (start) < TSC_CALIBRATE_TICKS)
+		barrier ();
+
+	old_level = intr_disable ();
+	pit1 = pit_now ();
+	tsc1 = rdtsc ();
+	intr_set_level (old_level);
+
+	hz = (tsc1 - tsc0) * PIT_HZ / (pit1 - pit0);
+	if (hz == 0)
+		PANIC ("time stamp counter is not running");
+
+	cp = palloc_get_page (PAL_ZERO);
+	if (cp == NULL)
+		PANIC ("can't allocate clock page");
+	cp->tsc_hz = hz;
+	cp->tsc_base = tsc0 - pit0 * hz / PIT_HZ;
+	cp->mult = (1000000000ULL << 32) / hz;
+	clock_page = cp;
+
+	printf ("%'"PRIu64" Hz.\n", hz);
+}
+
+/* Sleeps for CYCLES PIT cycles, less than a tick, by blocking
+   until the timer interrupt at the deadline. */
+static void
+hires_sleep (int64_t cycles) {
+	struct hires_sleeper s;
+	enum intr_level old_level;
+	struct list_elem *e;
+	int64_t now;
+
+	sema_init (&s.sema, 0);
+	old_level = intr_disable ();
+	now = pit_now ();
+	s.deadline = now + cycles;
+
+	/* Insert in order, after any with the same deadline. */
+	for (e = list_begin (&hires_list); e != list_end (&hires_list);
+			e = list_next (e))
+		if (list_entry (e, struct hires_sleeper, elem)->deadline > s.deadline)
+			break;
+	list_insert (e, &s.elem);
+
+	/* Interrupt sooner if the PIT is set for later. */
+	if (s.deadline < pit_start + pit_count)
+		arm (now);
+	sema_down (&s.sema);
+	intr_set_level (old_level);
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -178,11 +457,20 @@ real_time_sleep (int64_t num, int32_t denom) {
 		   timer_sleep() because it will yield the CPU to other
 		   processes. */
 		timer_sleep (ticks);
-	} else {
-		/* Otherwise, use a busy-wait loop for more accurate
-		   sub-tick timing.  We scale the numerator and denominator
-		   down by 1000 to avoid the possibility of overflow. */
-		ASSERT (denom % 1000 == 0);
-		busy_wait (loops_per_tick * num / 1000 * TIMER_FREQ / (denom / 1000));
+	} else if (num > 0) {
+		/* Otherwise, block until a one-shot timer interrupt at
+		   the deadline, which is accurate to a PIT cycle without
+		   keeping the CPU busy.  NUM is less than a tick's worth,
+		   so this cannot overflow. */
+		hires_sleep (DIV_ROUND_UP (num * PIT_HZ, denom));
 	}
 }
+
+/* Busy-wait for approximately NUM/DENOM seconds. */
+static void
+real_time_delay (int64_t num, int32_t denom) {
+	/* Scale the numerator and denominator down by 1000 to avoid
+	   the possibility of overflow. */
+	ASSERT (denom % 1000 == 0);
+	busy_wait (loops_per_tick * num / 1000 * TIMER_FREQ / (denom / 1000));
+}
@@ -0,0 +1,141 @@
+/* dentry.c: Cache of directory name lookups.
+ *
+ * Maps a (directory inode sector, name) pair to the inode sector
+ * the name refers to, so that repeated lookups of the same name
+ * do not read the directory again.  Names that were looked up and
+ * found missing are cached too, as negative entries.  The
+ * directory code keeps the cache current: dir_add() and
+ * dir_remove() overwrite the entry for the name they change. */
+
+#include "filesys/dentry.h"
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Most entries kept at once.  Past this, the least recently used
+ * entry is evicted. */
+#define DENTRY_MAX 256
+
+/* A cached name lookup. */
+struct dentry {
+	struct hash_elem hash_elem;         /* Element in dentry_table. */
+	struct list_elem lru_elem;          /* Element in dentry_lru. */
+	disk_sector_t dir_sector;           /* Inode sector of directory. */
+	disk_sector_t inode_sector;         /* Result, or DENTRY_NEGATIVE. */
+	char name[NAME_MAX + 1];            /* Null terminated file name. */
+};
+
+static struct hash dentry_table;       /* All entries, by key. */
+static struct list dentry_lru;         /* All entries, most recent first. */
+static size_t dentry_cnt;              /* Number of entries. */
+static struct lock dentry_lock;        /* Protects all of the above. */
+
+static uint64_t dentry_hash (const struct hash_elem *, void *);
+static bool dentry_less (const struct hash_elem *, const struct hash_elem *,
+		void *);
+
+/* Initializes the dentry cache. */
+void
+dentry_init (void) {
+	hash_init (&dentry_table, dentry_hash, dentry_less, NULL);
+	list_init (&dentry_lru);
+	dentry_cnt = 0;
+	lock_init (&dentry_lock);
+}
+
+/* Returns the entry for (DIR_SECTOR, NAME), or a null pointer if
+ * there is none.  Must be called with dentry_lock held. */
+static struct dentry *
+find (disk_sector_t dir_sector, const char *name) {
+	struct dentry key;
+	struct hash_elem *e;
+
+	key.dir_sector = dir_sector;
+	strlcpy (key.name, name, sizeof key.name);
+	e = hash_find (&dentry_table, &key.hash_elem);
+	return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+/* Looks up NAME in the directory whose inode is in DIR_SECTOR.
+ * Returns false if the cache knows nothing about it.  Otherwise
+ * returns true and sets *INODE_SECTORP to the sector of NAME's
+ * inode, or to DENTRY_NEGATIVE if NAME is known not to exist. */
+bool
+dentry_lookup (disk_sector_t dir_sector, const char *name,
+		disk_sector_t *inode_sectorp) {
+	struct dentry *d;
+
+	if (strlen (name) > NAME_MAX)
+		return false;
+
+	lock_acquire (&dentry_lock);
+	d = find (dir_sector, name);
+	if (d != NULL) {
+		list_remove (&d->lru_elem);
+		list_push_front (&dentry_lru, &d->lru_elem);
+		*inode_sectorp = d->inode_sector;
+	}
+	lock_release (&dentry_lock);
+	return d != NULL;
+}
+
+/* Records that NAME in the directory whose inode is in
+ * DIR_SECTOR refers to the inode in INODE_SECTOR, or does not
+ * exist if INODE_SECTOR is DENTRY_NEGATIVE.  Replaces whatever
+ * was known about NAME before. */
+void
+dentry_insert (disk_sector_t dir_sector, const char *name,
+		disk_sector_t inode_sector) {
+	struct dentry *d;
+
+	if (strlen (name) > NAME_MAX)
+		return;
+
+	lock_acquire (&dentry_lock);
+	d = find (dir_sector, name);
+	if (d != NULL) {
+		list_remove (&d->lru_elem);
+	} else {
+		if (dentry_cnt < DENTRY_MAX) {
+			d = malloc (sizeof *d);
+			if (d == NULL)
+				goto done;
+			dentry_cnt++;
+		} else {
+			/* Reuse the least recently used entry. */
+			d = list_entry (list_back (&dentry_lru), struct dentry, lru_elem);
+			list_remove (&d->lru_elem);
+			hash_delete (&dentry_table, &d->hash_elem);
+		}
+		d->dir_sector = dir_sector;
+		strlcpy (d->name, name, sizeof d->name);
+		hash_insert (&dentry_table, &d->hash_elem);
+	}
+	d->inode_sector = inode_sector;
+	list_push_front (&dentry_lru, &d->lru_elem);
+
+done:
+	lock_release (&dentry_lock);
+}
+
+/* Returns a hash value for dentry E. */
+static uint64_t
+dentry_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+	return hash_string (d->name) ^ hash_int (d->dir_sector);
+}
+
+/* Returns true if dentry A precedes dentry B. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+	const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+
+	if (a->dir_sector != b->dir_sector)
+		return a->dir_sector < b->dir_sector;
+	return strcmp (a->name, b->name) < 0;
+}
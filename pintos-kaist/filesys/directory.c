@@ -2,9 +2,12 @@
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include <hash.h>
+#include "filesys/dentry.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir {
@@ -19,11 +22,90 @@ struct dir_entry {
 	bool in_use;                        /* In use or free? */
 };
 
+/* Directories come in two on-disk formats.
+ *
+ * A small directory is a plain array of `struct dir_entry'.
+ * Once it needs more than LINEAR_ENTRY_MAX entries it is
+ * converted to hashed format: block 0 of the directory holds a
+ * `struct dir_index' and every other block holds a
+ * `struct dir_bucket'.  The index maps the low bits of a name's
+ * hash to the bucket holding it (extendible hashing), so a lookup
+ * reads the index block and, usually, a single bucket block. */
+
+/* Most entries a directory holds in linear format. */
+#define LINEAR_ENTRY_MAX (DISK_SECTOR_SIZE / sizeof (struct dir_entry))
+
+/* Identifies a hashed directory.  A linear directory cannot start
+ * with this value, because it is not a valid sector number. */
+#define DIR_INDEX_MAGIC 0x48524944
+
+/* Largest global depth of the index, and so its largest number of
+ * bucket slots. */
+#define INDEX_DEPTH_MAX 7
+#define INDEX_SLOT_CNT (1 << INDEX_DEPTH_MAX)
+
+/* Index block of a hashed directory. */
+struct dir_index {
+	uint32_t magic;                     /* DIR_INDEX_MAGIC. */
+	uint16_t depth;                     /* Slots in use: 1 << DEPTH. */
+	uint16_t block_cnt;                 /* Directory blocks in use. */
+	uint16_t buckets[INDEX_SLOT_CNT];   /* Bucket block for each slot. */
+	uint8_t unused[248];                /* Not used. */
+};
+
+/* Number of entries in one bucket block. */
+#define BUCKET_ENTRY_CNT 25
+
+/* Bucket block of a hashed directory. */
+struct dir_bucket {
+	uint16_t next;                      /* Overflow bucket block, or 0. */
+	uint16_t depth;                     /* Local depth. */
+	struct dir_entry entries[BUCKET_ENTRY_CNT]; /* Entries. */
+	uint8_t unused[8];                  /* Not used. */
+};
+
+/* First block of a directory, in either format. */
+union dir_head {
+	struct dir_index index;
+	struct dir_entry entries[LINEAR_ENTRY_MAX];
+	uint8_t raw[DISK_SECTOR_SIZE];
+};
+
+/* Byte offset of entry SLOT of bucket block BLOCK. */
+#define BUCKET_ENTRY_OFS(BLOCK, SLOT) \
+	((off_t) ((BLOCK) * DISK_SECTOR_SIZE + offsetof (struct dir_bucket, entries) \
+	          + (SLOT) * sizeof (struct dir_entry)))
+
+/* Serializes changes to directories against each other and
+ * against searches.  A name is looked up, added or removed as a
+ * whole under this lock, which keeps the dentry cache in step
+ * with the disk.  Reading and writing file data never takes it. */
+static struct lock dir_lock;
+
+/* dir_lookup() opens the inode it has found after releasing
+ * dir_lock, so that reading the inode from disk does not hold up
+ * other directory operations.  It holds OPEN_LOCK for reading
+ * until the inode is open, and dir_remove() takes it for writing,
+ * so that the inode cannot be removed and freed in between. */
+static struct rwlock open_lock;
+
+/* Initializes the directory module. */
+void
+dir_init (void) {
+	lock_init (&dir_lock);
+	rwlock_init (&open_lock);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
  * given SECTOR.  Returns true if successful, false on failure. */
 bool
 dir_create (disk_sector_t sector, size_t entry_cnt) {
-	return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+	/* If these assertions fail, a hashed directory block is not
+	 * exactly one sector in size. */
+	ASSERT (sizeof (struct dir_index) == DISK_SECTOR_SIZE);
+	ASSERT (sizeof (struct dir_bucket) == DISK_SECTOR_SIZE);
+
+	return inode_create (sector, entry_cnt * sizeof (struct dir_entry), true);
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -71,6 +153,108 @@ dir_get_inode (struct dir *dir) {
 	return dir->inode;
 }
 
+/* Reads directory block BLOCK of DIR into BUF.
+ * Returns true if successful, false on a short read. */
+static bool
+read_block (const struct dir *dir, uint16_t block, void *buf) {
+	return inode_read_at (dir->inode, buf, DISK_SECTOR_SIZE,
+			(off_t) block * DISK_SECTOR_SIZE) == DISK_SECTOR_SIZE;
+}
+
+/* Writes BUF to directory block BLOCK of DIR, extending DIR if
+ * necessary.  Returns true if successful. */
+static bool
+write_block (struct dir *dir, uint16_t block, const void *buf) {
+	return inode_write_at (dir->inode, buf, DISK_SECTOR_SIZE,
+			(off_t) block * DISK_SECTOR_SIZE) == DISK_SECTOR_SIZE;
+}
+
+/* Reads the first block of DIR into HEAD.
+ * Returns true if DIR is in hashed format, false if it is linear. */
+static bool
+read_head (const struct dir *dir, union dir_head *head) {
+	off_t bytes = inode_read_at (dir->inode, head, sizeof *head, 0);
+	return bytes == sizeof *head && head->index.magic == DIR_INDEX_MAGIC;
+}
+
+/* Returns the bucket slot of INDEX that NAME hashes to. */
+static size_t
+bucket_slot (const struct dir_index *index, const char *name) {
+	return hash_string (name) & ((1u << index->depth) - 1);
+}
+
+/* Searches linear-format DIR for NAME, scanning entries in
+ * chunks of LINEAR_ENTRY_MAX using CHUNK as a buffer.
+ * On success, sets *EP and *OFSP as lookup() does.  If FREEP is
+ * non-null, also sets *FREEP to the offset of the first unused
+ * slot, or to the end of the directory if every slot is used. */
+static bool
+linear_lookup (const struct dir *dir, union dir_head *chunk, const char *name,
+		struct dir_entry *ep, off_t *ofsp, off_t *freep) {
+	bool free_found = false;
+	off_t base;
+
+	for (base = 0; ; base += sizeof chunk->entries) {
+		off_t bytes = inode_read_at (dir->inode, chunk->entries,
+				sizeof chunk->entries, base);
+		size_t cnt = bytes / sizeof (struct dir_entry);
+		size_t i;
+
+		for (i = 0; i < cnt; i++) {
+			struct dir_entry *e = &chunk->entries[i];
+			off_t ofs = base + i * sizeof *e;
+			if (e->in_use && !strcmp (name, e->name)) {
+				if (ep != NULL)
+					*ep = *e;
+				if (ofsp != NULL)
+					*ofsp = ofs;
+				return true;
+			}
+			if (!e->in_use && !free_found && freep != NULL) {
+				*freep = ofs;
+				free_found = true;
+			}
+		}
+		if (cnt < LINEAR_ENTRY_MAX) {
+			if (!free_found && freep != NULL)
+				*freep = base + cnt * sizeof (struct dir_entry);
+			return false;
+		}
+	}
+}
+
+/* Searches hashed-format DIR, whose index is INDEX, for NAME,
+ * walking the bucket it hashes to and that bucket's overflow
+ * blocks.  On success, sets *EP and *OFSP as lookup() does. */
+static bool
+hashed_lookup (const struct dir *dir, const struct dir_index *index,
+		const char *name, struct dir_entry *ep, off_t *ofsp) {
+	struct dir_bucket *b = malloc (sizeof *b);
+	uint16_t block = index->buckets[bucket_slot (index, name)];
+	bool found = false;
+
+	if (b == NULL)
+		return false;
+	while (!found && block != 0 && read_block (dir, block, b)) {
+		size_t i;
+
+		for (i = 0; i < BUCKET_ENTRY_CNT; i++) {
+			struct dir_entry *e = &b->entries[i];
+			if (e->in_use && !strcmp (name, e->name)) {
+				if (ep != NULL)
+					*ep = *e;
+				if (ofsp != NULL)
+					*ofsp = BUCKET_ENTRY_OFS (block, i);
+				found = true;
+				break;
+			}
+		}
+		block = b->next;
+	}
+	free (b);
+	return found;
+}
+
 /* Searches DIR for a file with the given NAME.
  * If successful, returns true, sets *EP to the directory entry
  * if EP is non-null, and sets *OFSP to the byte offset of the
@@ -79,40 +263,205 @@ dir_get_inode (struct dir *dir) {
 static bool
 lookup (const struct dir *dir, const char *name,
 		struct dir_entry *ep, off_t *ofsp) {
-	struct dir_entry e;
-	size_t ofs;
+	union dir_head *head;
+	bool found;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
-	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-			ofs += sizeof e)
-		if (e.in_use && !strcmp (name, e.name)) {
-			if (ep != NULL)
-				*ep = e;
-			if (ofsp != NULL)
-				*ofsp = ofs;
-			return true;
+	head = malloc (sizeof *head);
+	if (head == NULL)
+		return false;
+	if (read_head (dir, head))
+		found = hashed_lookup (dir, &head->index, name, ep, ofsp);
+	else
+		found = linear_lookup (dir, head, name, ep, ofsp, NULL);
+	free (head);
+	return found;
+}
+
+/* Splits bucket block BLOCK of DIR, whose contents are B, in two
+ * by moving the entries whose next hash bit is set to a new
+ * bucket, doubling INDEX first if B is already as deep as INDEX.
+ * Writes back both buckets and INDEX.  Returns true if
+ * successful. */
+static bool
+split_bucket (struct dir *dir, struct dir_index *index,
+		uint16_t block, struct dir_bucket *b) {
+	struct dir_bucket *nb;
+	uint16_t new_block;
+	unsigned bit;
+	size_t i;
+	bool success;
+
+	if (index->block_cnt == UINT16_MAX)
+		return false;
+	nb = calloc (1, sizeof *nb);
+	if (nb == NULL)
+		return false;
+
+	if (b->depth == index->depth) {
+		size_t slot_cnt = 1u << index->depth;
+		for (i = 0; i < slot_cnt; i++)
+			index->buckets[i + slot_cnt] = index->buckets[i];
+		index->depth++;
+	}
+
+	new_block = index->block_cnt++;
+	bit = 1u << b->depth;
+	b->depth++;
+	nb->depth = b->depth;
+	for (i = 0; i < BUCKET_ENTRY_CNT; i++) {
+		struct dir_entry *e = &b->entries[i];
+		if (e->in_use && (hash_string (e->name) & bit)) {
+			nb->entries[i] = *e;
+			e->in_use = false;
 		}
-	return false;
+	}
+	for (i = 0; i < (1u << index->depth); i++)
+		if (index->buckets[i] == block && (i & bit))
+			index->buckets[i] = new_block;
+
+	success = (write_block (dir, new_block, nb)
+			&& write_block (dir, block, b)
+			&& write_block (dir, 0, index));
+	free (nb);
+	return success;
+}
+
+/* Adds E to hashed-format DIR, whose index is INDEX.  A full
+ * bucket is split while the index can still grow; past that,
+ * an overflow block is chained onto it.  Returns true if
+ * successful. */
+static bool
+hashed_add (struct dir *dir, struct dir_index *index,
+		const struct dir_entry *e) {
+	struct dir_bucket *b = malloc (sizeof *b);
+	bool success = false;
+
+	if (b == NULL)
+		return false;
+	for (;;) {
+		uint16_t first = index->buckets[bucket_slot (index, e->name)];
+		uint16_t block = first;
+		uint16_t new_block;
+		size_t i;
+
+		/* Take the first free slot in the bucket's chain. */
+		for (;;) {
+			if (!read_block (dir, block, b))
+				goto done;
+			for (i = 0; i < BUCKET_ENTRY_CNT; i++)
+				if (!b->entries[i].in_use) {
+					b->entries[i] = *e;
+					success = write_block (dir, block, b);
+					goto done;
+				}
+			if (b->next == 0)
+				break;
+			block = b->next;
+		}
+
+		/* Bucket is full.  Split it if it has no overflow blocks
+		 * and there is room to, then try again. */
+		if (block == first
+				&& (b->depth < index->depth || index->depth < INDEX_DEPTH_MAX)) {
+			if (!split_bucket (dir, index, block, b))
+				goto done;
+			continue;
+		}
+
+		/* Otherwise chain an overflow block onto the bucket. */
+		if (index->block_cnt == UINT16_MAX)
+			goto done;
+		new_block = index->block_cnt++;
+		b->next = new_block;
+		if (!write_block (dir, block, b))
+			goto done;
+		b->next = 0;
+		for (i = 0; i < BUCKET_ENTRY_CNT; i++)
+			b->entries[i].in_use = false;
+		b->entries[0] = *e;
+		success = (write_block (dir, new_block, b)
+				&& write_block (dir, 0, index));
+		goto done;
+	}
+
+done:
+	free (b);
+	return success;
+}
+
+/* Converts linear-format DIR to hashed format, using HEAD as a
+ * buffer, and leaves its new index in HEAD.
+ * Returns true if successful. */
+static bool
+convert_to_hashed (struct dir *dir, union dir_head *head) {
+	off_t length = inode_length (dir->inode);
+	size_t cnt = length / sizeof (struct dir_entry);
+	struct dir_entry *entries;
+	struct dir_bucket *b;
+	bool success = false;
+	size_t i;
+
+	entries = malloc (cnt * sizeof *entries);
+	b = calloc (1, sizeof *b);
+	if (entries == NULL || b == NULL)
+		goto done;
+	if (inode_read_at (dir->inode, entries, cnt * sizeof *entries, 0)
+			!= (off_t) (cnt * sizeof *entries))
+		goto done;
+
+	/* Start with one empty bucket in block 1. */
+	memset (head, 0, sizeof *head);
+	head->index.magic = DIR_INDEX_MAGIC;
+	head->index.depth = 0;
+	head->index.block_cnt = 2;
+	head->index.buckets[0] = 1;
+	if (!write_block (dir, 1, b) || !write_block (dir, 0, &head->index))
+		goto done;
+
+	for (i = 0; i < cnt; i++)
+		if (entries[i].in_use && !hashed_add (dir, &head->index, &entries[i]))
+			goto done;
+	success = true;
+
+done:
+	free (entries);
+	free (b);
+	return success;
 }
 
 /* Searches DIR for a file with the given NAME
  * and returns true if one exists, false otherwise.
  * On success, sets *INODE to an inode for the file, otherwise to
- * a null pointer.  The caller must close *INODE. */
+ * a null pointer.  The caller must close *INODE.
+ * Answers from the dentry cache when it can, and records the
+ * outcome there, found or not, when it has to search DIR. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
 		struct inode **inode) {
+	disk_sector_t dir_sector, inode_sector;
 	struct dir_entry e;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
-	if (lookup (dir, name, &e, NULL))
-		*inode = inode_open (e.inode_sector);
+	dir_sector = inode_get_inumber (dir->inode);
+	lock_acquire (&dir_lock);
+	if (!dentry_lookup (dir_sector, name, &inode_sector)) {
+		inode_sector = lookup (dir, name, &e, NULL) ? e.inode_sector
+		                                            : DENTRY_NEGATIVE;
+		dentry_insert (dir_sector, name, inode_sector);
+	}
+	rwlock_acquire_read (&open_lock);
+	lock_release (&dir_lock);
+
+	if (inode_sector != DENTRY_NEGATIVE)
+		*inode = inode_open (inode_sector);
 	else
 		*inode = NULL;
+	rwlock_release_read (&open_lock);
 
 	return *inode != NULL;
 }
@@ -125,6 +474,7 @@ dir_lookup (const struct dir *dir, const char *name,
  * error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
+	union dir_head *head;
 	struct dir_entry e;
 	off_t ofs;
 	bool success = false;
@@ -136,29 +486,48 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
 	if (*name == '\0' || strlen (name) > NAME_MAX)
 		return false;
 
-	/* Check that NAME is not in use. */
-	if (lookup (dir, name, NULL, NULL))
+	head = malloc (sizeof *head);
+	if (head == NULL)
+		return false;
+
+	e.in_use = true;
+	strlcpy (e.name, name, sizeof e.name);
+	e.inode_sector = inode_sector;
+
+	lock_acquire (&dir_lock);
+	if (read_head (dir, head)) {
+		/* Check that NAME is not in use. */
+		if (!hashed_lookup (dir, &head->index, name, NULL, NULL))
+			success = hashed_add (dir, &head->index, &e);
 		goto done;
+	}
 
-	/* Set OFS to offset of free slot.
-	 * If there are no free slots, then it will be set to the
+	/* Check that NAME is not in use, and set OFS to offset of free
+	 * slot.  If there are no free slots, then it will be set to the
 	 * current end-of-file.
 
 	 * inode_read_at() will only return a short read at end of file.
 	 * Otherwise, we'd need to verify that we didn't get a short
 	 * read due to something intermittent such as low memory. */
-	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-			ofs += sizeof e)
-		if (!e.in_use)
-			break;
+	if (linear_lookup (dir, head, name, NULL, NULL, &ofs))
+		goto done;
+
+	/* Switch to hashed format rather than grow past
+	 * LINEAR_ENTRY_MAX entries. */
+	if (ofs / sizeof e >= LINEAR_ENTRY_MAX) {
+		success = (convert_to_hashed (dir, head)
+				&& hashed_add (dir, &head->index, &e));
+		goto done;
+	}
 
 	/* Write slot. */
-	e.in_use = true;
-	strlcpy (e.name, name, sizeof e.name);
-	e.inode_sector = inode_sector;
 	success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 
 done:
+	if (success)
+		dentry_insert (inode_get_inumber (dir->inode), name, inode_sector);
+	lock_release (&dir_lock);
+	free (head);
 	return success;
 }
 
@@ -175,6 +544,9 @@ dir_remove (struct dir *dir, const char *name) {
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
+	lock_acquire (&dir_lock);
+	rwlock_acquire_write (&open_lock);
+
 	/* Find directory entry. */
 	if (!lookup (dir, name, &e, &ofs))
 		goto done;
@@ -191,26 +563,132 @@ dir_remove (struct dir *dir, const char *name) {
 
 	/* Remove inode. */
 	inode_remove (inode);
+	dentry_insert (inode_get_inumber (dir->inode), name, DENTRY_NEGATIVE);
 	success = true;
 
 done:
+	rwlock_release_write (&open_lock);
+	lock_release (&dir_lock);
 	inode_close (inode);
 	return success;
 }
 
+/* Reads up to MAX in-use entries of DIR into RECORDS, starting
+ * at DIR->POS, and advances DIR->POS past them.  Entries are read
+ * a directory block at a time, not one at a time.  Returns the
+ * number of entries read, which is 0 at the end of DIR.  Must be
+ * called with dir_lock held. */
+static size_t
+readdir (struct dir *dir, struct dir_record *records, size_t max) {
+	union dir_head *head;
+	struct dir_bucket *b;
+	uint16_t block_cnt;
+	size_t cnt = 0;
+
+	head = malloc (sizeof *head);
+	if (head == NULL)
+		return 0;
+
+	if (!read_head (dir, head)) {
+		/* In linear format, scan the entry array in chunks of
+		 * LINEAR_ENTRY_MAX, as linear_lookup() does. */
+		while (cnt < max) {
+			off_t base = dir->pos - dir->pos % sizeof head->entries;
+			off_t bytes = inode_read_at (dir->inode, head->entries,
+					sizeof head->entries, base);
+			size_t n = bytes / sizeof (struct dir_entry);
+			size_t i = (dir->pos - base) / sizeof (struct dir_entry);
+
+			for (; i < n && cnt < max; i++) {
+				struct dir_entry *e = &head->entries[i];
+				if (e->in_use) {
+					records[cnt].inode_sector = e->inode_sector;
+					strlcpy (records[cnt].name, e->name, sizeof records[cnt].name);
+					cnt++;
+				}
+			}
+			dir->pos = base + i * sizeof (struct dir_entry);
+			if (n < LINEAR_ENTRY_MAX)
+				break;
+		}
+		free (head);
+		return cnt;
+	}
+
+	/* In hashed format, walk the slots of every bucket block in
+	 * block order.  DIR->POS is the offset of the next slot. */
+	block_cnt = head->index.block_cnt;
+	free (head);
+	b = malloc (sizeof *b);
+	if (b == NULL)
+		return 0;
+	if (dir->pos < BUCKET_ENTRY_OFS (1, 0))
+		dir->pos = BUCKET_ENTRY_OFS (1, 0);
+	while (cnt < max && dir->pos / DISK_SECTOR_SIZE < block_cnt) {
+		uint16_t block = dir->pos / DISK_SECTOR_SIZE;
+		off_t ofs = dir->pos % DISK_SECTOR_SIZE;
+		size_t slot = 0;
+
+		if (ofs > (off_t) offsetof (struct dir_bucket, entries))
+			slot = (ofs - offsetof (struct dir_bucket, entries))
+				/ sizeof (struct dir_entry);
+		if (!read_block (dir, block, b))
+			break;
+		for (; slot < BUCKET_ENTRY_CNT && cnt < max; slot++) {
+			struct dir_entry *e = &b->entries[slot];
+			if (e->in_use) {
+				records[cnt].inode_sector = e->inode_sector;
+				strlcpy (records[cnt].name, e->name, sizeof records[cnt].name);
+				cnt++;
+			}
+		}
+		dir->pos = (slot < BUCKET_ENTRY_CNT ? BUCKET_ENTRY_OFS (block, slot)
+		                                    : BUCKET_ENTRY_OFS (block + 1, 0));
+	}
+	free (b);
+	return cnt;
+}
+
 /* Reads the next directory entry in DIR and stores the name in
  * NAME.  Returns true if successful, false if the directory
  * contains no more entries. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1]) {
-	struct dir_entry e;
+	struct dir_record record;
+	bool success;
+
+	lock_acquire (&dir_lock);
+	success = readdir (dir, &record, 1) == 1;
+	lock_release (&dir_lock);
+	if (success)
+		strlcpy (name, record.name, NAME_MAX + 1);
+	return success;
+}
 
-	while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) {
-		dir->pos += sizeof e;
-		if (e.in_use) {
-			strlcpy (name, e.name, NAME_MAX + 1);
-			return true;
-		}
-	}
-	return false;
+/* Reads up to MAX of the next entries in DIR into RECORDS.
+ * Returns the number of entries read, which is 0 once the
+ * directory contains no more entries.  Costs one disk read per
+ * directory block, however many entries it holds. */
+size_t
+dir_readdir_batch (struct dir *dir, struct dir_record *records, size_t max) {
+	size_t cnt;
+
+	lock_acquire (&dir_lock);
+	cnt = readdir (dir, records, max);
+	lock_release (&dir_lock);
+	return cnt;
+}
+
+/* Sets DIR's position, as used by dir_readdir() and
+ * dir_readdir_batch(), to POS. */
+void
+dir_seek (struct dir *dir, off_t pos) {
+	ASSERT (pos >= 0);
+	dir->pos = pos;
+}
+
+/* Returns DIR's position. */
+off_t
+dir_tell (const struct dir *dir) {
+	return dir->pos;
 }
@@ -1,6 +1,8 @@
 #include "filesys/fat.h"
+#include <bitmap.h>
 #include "devices/disk.h"
 #include "filesys/filesys.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
 #include <stdio.h>
@@ -24,12 +26,20 @@ struct fat_fs {
 	disk_sector_t data_start;
 	cluster_t last_clst;
 	struct lock write_lock;
+	struct bitmap *dirty;      /* FAT sectors changed since fat_flush(). */
+	size_t dirty_cnt;          /* Number of bits set in DIRTY. */
+	size_t free_cnt;           /* Free clusters. */
+	size_t reserved_cnt;       /* Free clusters set aside by fat_reserve(). */
 };
 
+/* Number of FAT entries in one sector. */
+#define FAT_ENTRIES_PER_SECTOR (DISK_SECTOR_SIZE / sizeof (cluster_t))
+
 static struct fat_fs *fat_fs;
 
 void fat_boot_create (void);
 void fat_fs_init (void);
+static void count_free (void);
 
 void
 fat_init (void) {
@@ -56,28 +66,30 @@ fat_open (void) {
 	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
 	if (fat_fs->fat == NULL)
 		PANIC ("FAT load failed");
+	if (fat_fs->dirty == NULL)
+		fat_fs->dirty = bitmap_create (fat_fs->bs.fat_sectors);
+	if (fat_fs->dirty == NULL)
+		PANIC ("FAT load failed");
 
-	// Load FAT directly from the disk
+	// Load FAT directly from the disk, the whole sectors in one
+	// transfer and a partial last sector through a bounce buffer
 	uint8_t *buffer = (uint8_t *) fat_fs->fat;
-	off_t bytes_read = 0;
-	off_t bytes_left = sizeof (fat_fs->fat);
 	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
-	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
-		bytes_left = fat_size_in_bytes - bytes_read;
-		if (bytes_left >= DISK_SECTOR_SIZE) {
-			disk_read (filesys_disk, fat_fs->bs.fat_start + i,
-			           buffer + bytes_read);
-			bytes_read += DISK_SECTOR_SIZE;
-		} else {
-			uint8_t *bounce = malloc (DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT load failed");
-			disk_read (filesys_disk, fat_fs->bs.fat_start + i, bounce);
-			memcpy (buffer + bytes_read, bounce, bytes_left);
-			bytes_read += bytes_left;
-			free (bounce);
-		}
+	const unsigned whole = fat_size_in_bytes / DISK_SECTOR_SIZE;
+	const off_t bytes_left = fat_size_in_bytes % DISK_SECTOR_SIZE;
+	enum disk_origin old_origin = disk_set_origin (DISK_FAT);
+	if (whole > 0)
+		disk_read_multi (filesys_disk, fat_fs->bs.fat_start, buffer, whole);
+	if (bytes_left > 0 && whole < fat_fs->bs.fat_sectors) {
+		uint8_t *bounce = malloc (DISK_SECTOR_SIZE);
+		if (bounce == NULL)
+			PANIC ("FAT load failed");
+		disk_read (filesys_disk, fat_fs->bs.fat_start + whole, bounce);
+		memcpy (buffer + whole * DISK_SECTOR_SIZE, bounce, bytes_left);
+		free (bounce);
 	}
+	disk_set_origin (old_origin);
+	count_free ();
 }
 
 void
@@ -90,27 +102,23 @@ fat_close (void) {
 	disk_write (filesys_disk, FAT_BOOT_SECTOR, bounce);
 	free (bounce);
 
-	// Write FAT directly to the disk
+	// Write FAT directly to the disk, as fat_open() reads it
 	uint8_t *buffer = (uint8_t *) fat_fs->fat;
-	off_t bytes_wrote = 0;
-	off_t bytes_left = sizeof (fat_fs->fat);
 	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
-	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
-		bytes_left = fat_size_in_bytes - bytes_wrote;
-		if (bytes_left >= DISK_SECTOR_SIZE) {
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i,
-			            buffer + bytes_wrote);
-			bytes_wrote += DISK_SECTOR_SIZE;
-		} else {
-			bounce = calloc (1, DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT close failed");
-			memcpy (bounce, buffer + bytes_wrote, bytes_left);
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i, bounce);
-			bytes_wrote += bytes_left;
-			free (bounce);
-		}
+	const unsigned whole = fat_size_in_bytes / DISK_SECTOR_SIZE;
+	const off_t bytes_left = fat_size_in_bytes % DISK_SECTOR_SIZE;
+	enum disk_origin old_origin = disk_set_origin (DISK_FAT);
+	if (whole > 0)
+		disk_write_multi (filesys_disk, fat_fs->bs.fat_start, buffer, whole);
+	if (bytes_left > 0 && whole < fat_fs->bs.fat_sectors) {
+		bounce = calloc (1, DISK_SECTOR_SIZE);
+		if (bounce == NULL)
+			PANIC ("FAT close failed");
+		memcpy (bounce, buffer + whole * DISK_SECTOR_SIZE, bytes_left);
+		disk_write (filesys_disk, fat_fs->bs.fat_start + whole, bounce);
+		free (bounce);
 	}
+	disk_set_origin (old_origin);
 }
 
 void
@@ -123,9 +131,14 @@ fat_create (void) {
 	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
 	if (fat_fs->fat == NULL)
 		PANIC ("FAT creation failed");
+	if (fat_fs->dirty == NULL)
+		fat_fs->dirty = bitmap_create (fat_fs->bs.fat_sectors);
+	if (fat_fs->dirty == NULL)
+		PANIC ("FAT creation failed");
 
 	// Set up ROOT_DIR_CLST
 	fat_put (ROOT_DIR_CLUSTER, EOChain);
+	count_free ();
 
 	// Fill up ROOT_DIR_CLUSTER region with 0
 	uint8_t *buf = calloc (1, DISK_SECTOR_SIZE);
@@ -137,14 +150,17 @@ fat_create (void) {
 
 void
 fat_boot_create (void) {
+	/* The metadata journal lies between the boot sector and the
+	 * FAT. */
+	unsigned int fat_start = JOURNAL_SECTOR + JOURNAL_SECTORS;
 	unsigned int fat_sectors =
-	    (disk_size (filesys_disk) - 1)
+	    (disk_size (filesys_disk) - fat_start)
 	    / (DISK_SECTOR_SIZE / sizeof (cluster_t) * SECTORS_PER_CLUSTER + 1) + 1;
 	fat_fs->bs = (struct fat_boot){
 	    .magic = FAT_MAGIC,
 	    .sectors_per_cluster = SECTORS_PER_CLUSTER,
 	    .total_sectors = disk_size (filesys_disk),
-	    .fat_start = 1,
+	    .fat_start = fat_start,
 	    .fat_sectors = fat_sectors,
 	    .root_dir_cluster = ROOT_DIR_CLUSTER,
 	};
@@ -152,42 +168,286 @@ fat_boot_create (void) {
 
 void
 fat_fs_init (void) {
-	/* TODO: Your code goes here. */
+	/* Every sector after the FAT holds one data cluster.  Cluster 0
+	 * is never allocated, so that 0 can mean "no cluster". */
+	fat_fs->data_start = fat_fs->bs.fat_start + fat_fs->bs.fat_sectors;
+	fat_fs->fat_length = (fat_fs->bs.total_sectors - fat_fs->data_start)
+	                     / SECTORS_PER_CLUSTER + 1;
+	fat_fs->last_clst = ROOT_DIR_CLUSTER;
+	lock_init (&fat_fs->write_lock);
 }
 
 /*----------------------------------------------------------------------------*/
 /* FAT handling                                                               */
 /*----------------------------------------------------------------------------*/
 
+/* Counts the free clusters of the FAT just loaded or created. */
+static void
+count_free (void) {
+	cluster_t i;
+
+	fat_fs->free_cnt = 0;
+	fat_fs->reserved_cnt = 0;
+	for (i = 1; i < fat_fs->fat_length; i++)
+		if (fat_fs->fat[i] == 0)
+			fat_fs->free_cnt++;
+}
+
+/* Adds a cluster to the chain, like fat_create_chain(), taking it
+ * out of the clusters set aside by fat_reserve() if RESERVED is
+ * true and out of the unreserved ones otherwise. */
+static cluster_t
+create_chain (cluster_t clst, bool reserved) {
+	cluster_t new_clst = 0;
+	cluster_t i;
+
+	lock_acquire (&fat_fs->write_lock);
+	ASSERT (!reserved || fat_fs->reserved_cnt > 0);
+	if (!reserved && fat_fs->free_cnt == fat_fs->reserved_cnt) {
+		lock_release (&fat_fs->write_lock);
+		return 0;
+	}
+
+	/* Next-fit search for a free cluster, starting after the
+	 * cluster handed out most recently. */
+	for (i = 0; i < fat_fs->fat_length - 1; i++) {
+		cluster_t cand = (fat_fs->last_clst + i) % (fat_fs->fat_length - 1) + 1;
+		if (fat_fs->fat[cand] == 0) {
+			new_clst = cand;
+			break;
+		}
+	}
+
+	if (new_clst != 0) {
+		fat_put (new_clst, EOChain);
+		if (clst != 0)
+			fat_put (clst, new_clst);
+		fat_fs->last_clst = new_clst;
+		fat_fs->free_cnt--;
+		if (reserved)
+			fat_fs->reserved_cnt--;
+	}
+
+	lock_release (&fat_fs->write_lock);
+	return new_clst;
+}
+
 /* Add a cluster to the chain.
  * If CLST is 0, start a new chain.
  * Returns 0 if fails to allocate a new cluster. */
 cluster_t
 fat_create_chain (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	return create_chain (clst, false);
+}
+
+/* Sets aside CNT free clusters, which only fat_claim_chain() may
+ * then allocate.  Returns false, setting nothing aside, if fewer
+ * than CNT unreserved clusters are free. */
+bool
+fat_reserve (size_t cnt) {
+	bool success;
+
+	lock_acquire (&fat_fs->write_lock);
+	success = cnt <= fat_fs->free_cnt - fat_fs->reserved_cnt;
+	if (success)
+		fat_fs->reserved_cnt += cnt;
+	lock_release (&fat_fs->write_lock);
+	return success;
+}
+
+/* Gives back CNT clusters set aside by fat_reserve(). */
+void
+fat_unreserve (size_t cnt) {
+	lock_acquire (&fat_fs->write_lock);
+	ASSERT (cnt <= fat_fs->reserved_cnt);
+	fat_fs->reserved_cnt -= cnt;
+	lock_release (&fat_fs->write_lock);
+}
+
+/* Like fat_create_chain(), but takes the cluster out of those set
+ * aside by fat_reserve(), so that it cannot fail. */
+cluster_t
+fat_claim_chain (cluster_t clst) {
+	return create_chain (clst, true);
 }
 
 /* Remove the chain of clusters starting from CLST.
  * If PCLST is 0, assume CLST as the start of the chain. */
 void
 fat_remove_chain (cluster_t clst, cluster_t pclst) {
-	/* TODO: Your code goes here. */
+	lock_acquire (&fat_fs->write_lock);
+
+	if (pclst != 0)
+		fat_put (pclst, EOChain);
+	while (clst != 0 && clst != EOChain) {
+		cluster_t next = fat_fs->fat[clst];
+		fat_put (clst, 0);
+		fat_fs->free_cnt++;
+		journal_revoke (cluster_to_sector (clst), SECTORS_PER_CLUSTER);
+		clst = next;
+	}
+
+	lock_release (&fat_fs->write_lock);
 }
 
 /* Update a value in the FAT table. */
 void
 fat_put (cluster_t clst, cluster_t val) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst < fat_fs->fat_length);
+	fat_fs->fat[clst] = val;
+	if (fat_fs->dirty != NULL
+			&& !bitmap_test (fat_fs->dirty, clst / FAT_ENTRIES_PER_SECTOR)) {
+		bitmap_mark (fat_fs->dirty, clst / FAT_ENTRIES_PER_SECTOR);
+		fat_fs->dirty_cnt++;
+	}
+}
+
+/* Writes the FAT sectors that changed since the last flush
+ * through the metadata journal. */
+void
+fat_flush (void) {
+	uint8_t *bounce = malloc (DISK_SECTOR_SIZE);
+	size_t i;
+
+	if (bounce == NULL)
+		PANIC ("FAT flush failed");
+
+	lock_acquire (&fat_fs->write_lock);
+	for (i = 0; i < fat_fs->bs.fat_sectors; i++) {
+		size_t first = i * FAT_ENTRIES_PER_SECTOR;
+		size_t cnt;
+
+		if (!bitmap_test (fat_fs->dirty, i) || first >= fat_fs->fat_length)
+			continue;
+		cnt = fat_fs->fat_length - first;
+		if (cnt > FAT_ENTRIES_PER_SECTOR)
+			cnt = FAT_ENTRIES_PER_SECTOR;
+		memset (bounce, 0, DISK_SECTOR_SIZE);
+		memcpy (bounce, fat_fs->fat + first, cnt * sizeof (cluster_t));
+		journal_write (fat_fs->bs.fat_start + i, bounce);
+		bitmap_reset (fat_fs->dirty, i);
+	}
+	fat_fs->dirty_cnt = 0;
+	lock_release (&fat_fs->write_lock);
+	free (bounce);
+}
+
+/* Returns the number of FAT sectors that the next fat_flush()
+ * will write.  Read without locking, so that the journal can
+ * call it under its own lock; a stale count is off only by
+ * sectors that file system operations in progress have changed,
+ * which their journal reservations cover. */
+size_t
+fat_dirty_cnt (void) {
+	return fat_fs->dirty != NULL ? fat_fs->dirty_cnt : 0;
 }
 
 /* Fetch a value in the FAT table. */
 cluster_t
 fat_get (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst < fat_fs->fat_length);
+	return fat_fs->fat[clst];
 }
 
 /* Covert a cluster # to a sector number. */
 disk_sector_t
 cluster_to_sector (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst != 0 && clst < fat_fs->fat_length);
+	return fat_fs->data_start + (clst - 1) * SECTORS_PER_CLUSTER;
+}
+
+/* Convert a sector number to the cluster # that contains it. */
+cluster_t
+sector_to_cluster (disk_sector_t sector) {
+	ASSERT (sector >= fat_fs->data_start);
+	return (sector - fat_fs->data_start) / SECTORS_PER_CLUSTER + 1;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Chain position cache                                                       */
+/*----------------------------------------------------------------------------*/
+
+/* Initializes CACHE, which starts out knowing nothing. */
+void
+fat_chain_cache_init (struct fat_chain_cache *cache) {
+	cache->map = NULL;
+	cache->map_cnt = 0;
+	cache->known_cnt = 0;
+}
+
+/* Frees the memory held by CACHE. */
+void
+fat_chain_cache_destroy (struct fat_chain_cache *cache) {
+	free (cache->map);
+	fat_chain_cache_init (cache);
+}
+
+/* Makes room in CACHE for at least CNT positions.
+ * Returns false if memory is short. */
+static bool
+chain_cache_reserve (struct fat_chain_cache *cache, size_t cnt) {
+	size_t new_cnt;
+	cluster_t *new_map;
+
+	if (cnt <= cache->map_cnt)
+		return true;
+	new_cnt = cache->map_cnt > 0 ? cache->map_cnt * 2 : 16;
+	while (new_cnt < cnt)
+		new_cnt *= 2;
+	new_map = realloc (cache->map, new_cnt * sizeof *new_map);
+	if (new_map == NULL)
+		return false;
+	cache->map = new_map;
+	cache->map_cnt = new_cnt;
+	return true;
+}
+
+/* Returns the IDXth cluster (counting from 0) of the chain that
+ * begins at HEAD, or 0 if the chain is shorter than that.
+ * Positions are recorded in CACHE as the chain is walked, so a
+ * lookup only follows FAT links past the furthest position seen
+ * so far, and repeated or backward seeks cost O(1). */
+cluster_t
+fat_chain_seek (struct fat_chain_cache *cache, cluster_t head, size_t idx) {
+	cluster_t clst;
+	size_t pos;
+
+	if (head == 0)
+		return 0;
+	if (cache->known_cnt > 0 && cache->map[0] != head)
+		cache->known_cnt = 0;
+	if (idx < cache->known_cnt)
+		return cache->map[idx];
+
+	if (cache->known_cnt == 0) {
+		if (!chain_cache_reserve (cache, 1))
+			goto uncached;
+		cache->map[cache->known_cnt++] = head;
+	}
+
+	while (cache->known_cnt <= idx) {
+		clst = fat_get (cache->map[cache->known_cnt - 1]);
+		if (clst == 0 || clst == EOChain)
+			return 0;
+		if (!chain_cache_reserve (cache, cache->known_cnt + 1))
+			goto uncached;
+		cache->map[cache->known_cnt++] = clst;
+	}
+	return cache->map[idx];
+
+uncached:
+	/* Out of memory: walk the rest of the way without recording. */
+	if (cache->known_cnt > 0) {
+		pos = cache->known_cnt - 1;
+		clst = cache->map[pos];
+	} else {
+		pos = 0;
+		clst = head;
+	}
+	for (; pos < idx; pos++) {
+		clst = fat_get (clst);
+		if (clst == 0 || clst == EOChain)
+			return 0;
+	}
+	return clst;
 }
@@ -2,6 +2,8 @@
 #include <debug.h>
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
 
 /* An open file. */
 struct file {
@@ -89,9 +91,8 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) {
 /* Writes SIZE bytes from BUFFER into FILE,
  * starting at the file's current position.
  * Returns the number of bytes actually written,
- * which may be less than SIZE if end of file is reached.
- * (Normally we'd grow the file in that case, but file growth is
- * not yet implemented.)
+ * which may be less than SIZE if the disk is full.
+ * Writing past end of file extends the file.
  * Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) {
@@ -103,9 +104,8 @@ file_write (struct file *file, const void *buffer, off_t size) {
 /* Writes SIZE bytes from BUFFER into FILE,
  * starting at offset FILE_OFS in the file.
  * Returns the number of bytes actually written,
- * which may be less than SIZE if end of file is reached.
- * (Normally we'd grow the file in that case, but file growth is
- * not yet implemented.)
+ * which may be less than SIZE if the disk is full.
+ * Writing past end of file extends the file.
  * The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
@@ -113,6 +113,80 @@ file_write_at (struct file *file, const void *buffer, off_t size,
 	return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Copies SIZE bytes from IN, starting at offset IN_OFS, to OUT,
+ * starting at offset OUT_OFS, without going through user
+ * memory.  Holes in IN are not read; the matching part of OUT is
+ * left as a hole if it is past OUT's end, so a sparse file stays
+ * sparse.  Returns the number of bytes copied, which may be less
+ * than SIZE if IN ends first or the disk is full, or -1 if IN and
+ * OUT are the same file and the two ranges overlap or memory is
+ * short.  Neither file's position is affected. */
+off_t
+file_copy_range (struct file *in, off_t in_ofs,
+		struct file *out, off_t out_ofs, off_t size) {
+	off_t length = inode_length (in->inode);
+	off_t bytes_copied = 0;
+	off_t run_end = in_ofs;
+	bool in_data = true;
+	uint8_t *buffer;
+
+	if (in_ofs >= length || size <= 0)
+		return 0;
+	if (size > length - in_ofs)
+		size = length - in_ofs;
+	if (in->inode == out->inode
+			&& in_ofs < out_ofs + size && out_ofs < in_ofs + size)
+		return -1;
+
+	buffer = palloc_get_page (0);
+	if (buffer == NULL)
+		return -1;
+
+	while (bytes_copied < size) {
+		off_t ofs = in_ofs + bytes_copied;
+		off_t chunk_size, bytes_read, bytes_written;
+
+		/* Find the run of data or hole that OFS lies in, once per
+		 * run rather than once per chunk. */
+		if (ofs >= run_end) {
+			off_t data = inode_seek_data (in->inode, ofs);
+			in_data = data == ofs;
+			run_end = in_data ? inode_seek_hole (in->inode, ofs) : data;
+		}
+
+		if (!in_data
+				&& out_ofs + bytes_copied >= inode_length (out->inode)) {
+			/* A hole that lands past OUT's end: skip it, and the
+			 * next write leaves it as a hole in OUT too.  If the
+			 * range ends in the hole, still copy its last byte so
+			 * that OUT grows to the full length. */
+			off_t skip_to = run_end < in_ofs + size ? run_end : in_ofs + size - 1;
+			if (skip_to > ofs) {
+				bytes_copied = skip_to - in_ofs;
+				continue;
+			}
+		}
+
+		/* Copy up to the end of this run of data, or of this
+		 * hole if OUT already has data to overwrite there. */
+		chunk_size = run_end - ofs;
+		if (chunk_size > size - bytes_copied)
+			chunk_size = size - bytes_copied;
+		if (chunk_size > PGSIZE)
+			chunk_size = PGSIZE;
+
+		bytes_read = inode_read_at (in->inode, buffer, chunk_size, ofs);
+		bytes_written = inode_write_at (out->inode, buffer, bytes_read,
+				out_ofs + bytes_copied);
+		bytes_copied += bytes_written;
+		if (bytes_written < chunk_size)
+			break;
+	}
+
+	palloc_free_page (buffer);
+	return bytes_copied;
+}
+
 /* Prevents write operations on FILE's underlying inode
  * until file_allow_write() is called or FILE is closed. */
 void
@@ -5,13 +5,17 @@
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
+#include "filesys/dentry.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
 #include "devices/disk.h"
 
 /* The disk that contains the file system. */
 struct disk *filesys_disk;
 
 static void do_format (void);
+static bool inode_sector_allocate (disk_sector_t *);
+static void inode_sector_release (disk_sector_t);
 
 /* Initializes the file system module.
  * If FORMAT is true, reformats the file system. */
@@ -22,6 +26,8 @@ filesys_init (bool format) {
 		PANIC ("hd0:1 (hdb) not present, file system initialization failed");
 
 	inode_init ();
+	dentry_init ();
+	dir_init ();
 
 #ifdef EFILESYS
 	fat_init ();
@@ -29,6 +35,7 @@ filesys_init (bool format) {
 	if (format)
 		do_format ();
 
+	journal_open ();
 	fat_open ();
 #else
 	/* Original FS */
@@ -37,6 +44,7 @@ filesys_init (bool format) {
 	if (format)
 		do_format ();
 
+	journal_open ();
 	free_map_open ();
 #endif
 }
@@ -45,6 +53,9 @@ filesys_init (bool format) {
  * to disk. */
 void
 filesys_done (void) {
+	inode_sync_all ();
+	journal_close ();
+
 	/* Original FS */
 #ifdef EFILESYS
 	fat_close ();
@@ -60,14 +71,19 @@ filesys_done (void) {
 bool
 filesys_create (const char *name, off_t initial_size) {
 	disk_sector_t inode_sector = 0;
-	struct dir *dir = dir_open_root ();
-	bool success = (dir != NULL
-			&& free_map_allocate (1, &inode_sector)
-			&& inode_create (inode_sector, initial_size)
+	struct dir *dir;
+	bool success;
+
+	journal_begin ();
+	dir = dir_open_root ();
+	success = (dir != NULL
+			&& inode_sector_allocate (&inode_sector)
+			&& inode_create (inode_sector, initial_size, false)
 			&& dir_add (dir, name, inode_sector));
 	if (!success && inode_sector != 0)
-		free_map_release (inode_sector, 1);
+		inode_sector_release (inode_sector);
 	dir_close (dir);
+	journal_end ();
 
 	return success;
 }
@@ -76,12 +92,22 @@ filesys_create (const char *name, off_t initial_size) {
  * Returns the new file if successful or a null pointer
  * otherwise.
  * Fails if no file named NAME exists,
- * or if an internal memory allocation fails. */
+ * or if an internal memory allocation fails.
+ * NAME "/" opens the root directory itself, whose entries can
+ * then be listed with getdents. */
 struct file *
 filesys_open (const char *name) {
-	struct dir *dir = dir_open_root ();
+	struct dir *dir;
 	struct inode *inode = NULL;
 
+	dir = dir_open_root ();
+	if (!strcmp (name, "/")) {
+		if (dir != NULL)
+			inode = inode_reopen (dir_get_inode (dir));
+		dir_close (dir);
+		return file_open (inode);
+	}
+
 	if (dir != NULL)
 		dir_lookup (dir, name, &inode);
 	dir_close (dir);
@@ -95,21 +121,55 @@ filesys_open (const char *name) {
  * or if an internal memory allocation fails. */
 bool
 filesys_remove (const char *name) {
-	struct dir *dir = dir_open_root ();
-	bool success = dir != NULL && dir_remove (dir, name);
+	struct dir *dir;
+	bool success;
+
+	journal_begin ();
+	dir = dir_open_root ();
+	success = dir != NULL && dir_remove (dir, name);
 	dir_close (dir);
+	journal_end ();
 
 	return success;
 }
 
+/* Allocates a sector to hold a new inode and stores it into
+ * *SECTORP.  Returns true if successful, false if the disk is
+ * full. */
+static bool
+inode_sector_allocate (disk_sector_t *sectorp) {
+#ifdef EFILESYS
+	cluster_t clst = fat_create_chain (0);
+	if (clst == 0)
+		return false;
+	*sectorp = cluster_to_sector (clst);
+	return true;
+#else
+	return free_map_allocate (1, sectorp);
+#endif
+}
+
+/* Releases SECTOR, which was allocated by inode_sector_allocate(). */
+static void
+inode_sector_release (disk_sector_t sector) {
+#ifdef EFILESYS
+	fat_remove_chain (sector_to_cluster (sector), 0);
+#else
+	free_map_release (sector, 1);
+#endif
+}
+
 /* Formats the file system. */
 static void
 do_format (void) {
 	printf ("Formatting file system...");
+	journal_format ();
 
 #ifdef EFILESYS
 	/* Create FAT and save it to the disk. */
 	fat_create ();
+	if (!dir_create (ROOT_DIR_SECTOR, 16))
+		PANIC ("root directory creation failed");
 	fat_close ();
 #else
 	free_map_create ();
@@ -1,21 +1,267 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
+#include <stdint.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per disk sector. */
 
+/* Protects the in-memory free map, its group summaries, the
+ * free and reserved counts, the next-fit hint and DIRTY_MAP.  Allocation and release only update
+ * those; free_map_flush() holds the lock while it writes the dirty
+ * parts of the bitmap to the free map file, so that a part is never
+ * marked clean while an update to it is missing from the file.  The
+ * free map file never grows, so writing it cannot recurse into the
+ * allocator. */
+static struct lock free_map_lock;
+
+/* The free map is summarized in groups of GROUP_SECTORS sectors,
+ * so that a search can step over full or fragmented groups
+ * without testing their bits one by one. */
+#define GROUP_SECTORS 256
+
+/* Summary of the free sectors in one group. */
+struct group {
+	uint16_t free_cnt;                  /* Free sectors. */
+	uint16_t longest;                   /* Longest free run. */
+	uint16_t head;                      /* Free run at the start. */
+	uint16_t tail;                      /* Free run at the end. */
+};
+
+static struct group *groups;         /* Summary of each group. */
+static size_t group_cnt;             /* Number of groups. */
+
+/* Free sectors, and how many of them are reserved by
+ * free_map_reserve().  Ordinary allocations only take sectors
+ * beyond the reserved ones, so that a reservation can always be
+ * claimed. */
+static size_t free_cnt;
+static size_t reserved_cnt;
+
+/* Next-fit hint: the search for free sectors starts in the group
+ * holding this sector, just past the last allocation, and wraps
+ * around. */
+static disk_sector_t next_hint;
+
+/* Changes to the free map reach the free map file lazily.  One bit
+ * per sector of the free map file, set when that part of the
+ * bitmap has changed since it was last written. */
+#define MAP_BITS_PER_SECTOR (DISK_SECTOR_SIZE * 8)
+static struct bitmap *dirty_map;
+static size_t dirty_cnt;             /* Number of bits set in DIRTY_MAP. */
+
+/* Returns the number of sectors in group G. */
+static size_t
+group_len (size_t g) {
+	size_t size = bitmap_size (free_map);
+	size_t start = g * GROUP_SECTORS;
+
+	return size - start < GROUP_SECTORS ? size - start : GROUP_SECTORS;
+}
+
+/* Recomputes the summary of group G from the free map. */
+static void
+summarize (size_t g) {
+	struct group *grp = &groups[g];
+	size_t start = g * GROUP_SECTORS;
+	size_t len = group_len (g);
+	size_t run = 0;
+	size_t i;
+
+	grp->free_cnt = grp->longest = grp->head = 0;
+	for (i = 0; i < len; i++) {
+		if (bitmap_test (free_map, start + i)) {
+			if (run == i)
+				grp->head = run;
+			run = 0;
+			continue;
+		}
+		grp->free_cnt++;
+		if (++run > grp->longest)
+			grp->longest = run;
+	}
+	if (run == len)
+		grp->head = run;
+	grp->tail = run;
+}
+
+/* Recomputes the summary of every group, and the free count. */
+static void
+summarize_all (void) {
+	size_t g;
+
+	free_cnt = 0;
+	for (g = 0; g < group_cnt; g++) {
+		summarize (g);
+		free_cnt += groups[g].free_cnt;
+	}
+}
+
+/* Returns the first sector of a run of CNT free sectors lying
+ * within group G, which must have one. */
+static size_t
+scan_group (size_t g, size_t cnt) {
+	size_t start = g * GROUP_SECTORS;
+	size_t end = start + group_len (g);
+	size_t run = 0;
+	size_t i;
+
+	for (i = start; i < end; i++) {
+		if (bitmap_test (free_map, i))
+			run = 0;
+		else if (++run >= cnt)
+			return i + 1 - run;
+	}
+	NOT_REACHED ();
+}
+
+/* Returns the first sector of a run of CNT free sectors that
+ * begins in the free tail of group G and continues into the
+ * groups after it, or BITMAP_ERROR if there is none. */
+static size_t
+scan_across (size_t g, size_t cnt) {
+	size_t run = groups[g].tail;
+	size_t h;
+
+	if (run == 0)
+		return BITMAP_ERROR;
+	for (h = g + 1; run < cnt && h < group_cnt; h++) {
+		if (groups[h].free_cnt != group_len (h)) {
+			run += groups[h].head;
+			break;
+		}
+		run += groups[h].free_cnt;
+	}
+	if (run < cnt)
+		return BITMAP_ERROR;
+	return g * GROUP_SECTORS + group_len (g) - groups[g].tail;
+}
+
+/* Finds CNT consecutive free sectors, searching group by group
+ * from the next-fit hint.  Returns the first sector, or
+ * BITMAP_ERROR if there is no such run. */
+static size_t
+find_run (size_t cnt) {
+	size_t first = next_hint / GROUP_SECTORS;
+	size_t i;
+
+	for (i = 0; i < group_cnt; i++) {
+		size_t g = (first + i) % group_cnt;
+		size_t sector;
+
+		if (groups[g].free_cnt == 0)
+			continue;
+		if (groups[g].longest >= cnt)
+			return scan_group (g, cnt);
+		sector = scan_across (g, cnt);
+		if (sector != BITMAP_ERROR)
+			return sector;
+	}
+	return BITMAP_ERROR;
+}
+
+/* Sets the CNT sectors starting at SECTOR, which are all !VALUE,
+ * to VALUE in the free map, and updates the summaries, the free
+ * count and the dirty sectors to match. */
+static void
+mark (disk_sector_t sector, size_t cnt, bool value) {
+	size_t g, i;
+
+	if (cnt == 0)
+		return;
+	bitmap_set_multiple (free_map, sector, cnt, value);
+	if (value)
+		free_cnt -= cnt;
+	else
+		free_cnt += cnt;
+	for (g = sector / GROUP_SECTORS;
+			g <= (sector + cnt - 1) / GROUP_SECTORS; g++)
+		summarize (g);
+	for (i = sector / MAP_BITS_PER_SECTOR;
+			i <= (sector + cnt - 1) / MAP_BITS_PER_SECTOR; i++)
+		if (!bitmap_test (dirty_map, i)) {
+			bitmap_mark (dirty_map, i);
+			dirty_cnt++;
+		}
+}
+
 /* Initializes the free map. */
 void
 free_map_init (void) {
-	free_map = bitmap_create (disk_size (filesys_disk));
-	if (free_map == NULL)
+	size_t size = disk_size (filesys_disk);
+
+	free_map = bitmap_create (size);
+	group_cnt = DIV_ROUND_UP (size, GROUP_SECTORS);
+	groups = calloc (group_cnt, sizeof *groups);
+	dirty_map = bitmap_create (DIV_ROUND_UP (size, MAP_BITS_PER_SECTOR));
+	if (free_map == NULL || groups == NULL || dirty_map == NULL)
 		PANIC ("bitmap creation failed--disk is too large");
 	bitmap_mark (free_map, FREE_MAP_SECTOR);
 	bitmap_mark (free_map, ROOT_DIR_SECTOR);
+	bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+	summarize_all ();
+	reserved_cnt = 0;
+	next_hint = 0;
+	lock_init (&free_map_lock);
+}
+
+/* Allocates CNT consecutive sectors and stores the first into
+ * *SECTORP, taking them out of the reservation if RESERVED is
+ * true and out of the unreserved sectors otherwise.  Returns
+ * true if successful. */
+static bool
+allocate (size_t cnt, disk_sector_t *sectorp, bool reserved) {
+	size_t sector = BITMAP_ERROR;
+
+	lock_acquire (&free_map_lock);
+	ASSERT (!reserved || cnt <= reserved_cnt);
+	if (reserved || cnt <= free_cnt - reserved_cnt)
+		sector = find_run (cnt);
+	if (sector != BITMAP_ERROR) {
+		mark (sector, cnt, true);
+		if (reserved)
+			reserved_cnt -= cnt;
+		next_hint = (sector + cnt) % bitmap_size (free_map);
+		*sectorp = sector;
+	}
+	lock_release (&free_map_lock);
+	return sector != BITMAP_ERROR;
+}
+
+/* Allocates up to CNT consecutive sectors beginning exactly at
+ * SECTOR, like allocate().  Returns the number allocated. */
+static size_t
+allocate_at (disk_sector_t sector, size_t cnt, bool reserved) {
+	size_t size = bitmap_size (free_map);
+	size_t i;
+
+	if (sector >= size)
+		return 0;
+	if (cnt > size - sector)
+		cnt = size - sector;
+
+	lock_acquire (&free_map_lock);
+	ASSERT (!reserved || cnt <= reserved_cnt);
+	if (!reserved && cnt > free_cnt - reserved_cnt)
+		cnt = free_cnt - reserved_cnt;
+	for (i = 0; i < cnt; i++)
+		if (bitmap_test (free_map, sector + i))
+			break;
+	if (i > 0) {
+		mark (sector, i, true);
+		if (reserved)
+			reserved_cnt -= i;
+		next_hint = (sector + i) % size;
+	}
+	lock_release (&free_map_lock);
+	return i;
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
@@ -24,24 +270,101 @@ free_map_init (void) {
  * available. */
 bool
 free_map_allocate (size_t cnt, disk_sector_t *sectorp) {
-	disk_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-	if (sector != BITMAP_ERROR
-			&& free_map_file != NULL
-			&& !bitmap_write (free_map, free_map_file)) {
-		bitmap_set_multiple (free_map, sector, cnt, false);
-		sector = BITMAP_ERROR;
-	}
-	if (sector != BITMAP_ERROR)
-		*sectorp = sector;
-	return sector != BITMAP_ERROR;
+	return allocate (cnt, sectorp, false);
+}
+
+/* Allocates up to CNT consecutive sectors beginning exactly at
+ * SECTOR, stopping at the first sector that is already in use.
+ * Returns the number of sectors allocated, which is 0 if SECTOR
+ * itself is in use or lies past the end of the disk. */
+size_t
+free_map_allocate_at (disk_sector_t sector, size_t cnt) {
+	return allocate_at (sector, cnt, false);
+}
+
+/* Sets aside CNT free sectors, which only free_map_claim() and
+ * free_map_claim_at() may then allocate.  Returns false, setting
+ * nothing aside, if fewer than CNT unreserved sectors are free. */
+bool
+free_map_reserve (size_t cnt) {
+	bool success;
+
+	lock_acquire (&free_map_lock);
+	success = cnt <= free_cnt - reserved_cnt;
+	if (success)
+		reserved_cnt += cnt;
+	lock_release (&free_map_lock);
+	return success;
+}
+
+/* Gives back CNT sectors set aside by free_map_reserve(). */
+void
+free_map_unreserve (size_t cnt) {
+	lock_acquire (&free_map_lock);
+	ASSERT (cnt <= reserved_cnt);
+	reserved_cnt -= cnt;
+	lock_release (&free_map_lock);
+}
+
+/* Like free_map_allocate(), but takes the CNT sectors out of
+ * those set aside by free_map_reserve(), which must include
+ * them. */
+bool
+free_map_claim (size_t cnt, disk_sector_t *sectorp) {
+	return allocate (cnt, sectorp, true);
+}
+
+/* Like free_map_allocate_at(), but takes the sectors out of those
+ * set aside by free_map_reserve(), which must include CNT. */
+size_t
+free_map_claim_at (disk_sector_t sector, size_t cnt) {
+	return allocate_at (sector, cnt, true);
 }
 
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (disk_sector_t sector, size_t cnt) {
+	journal_revoke (sector, cnt);
+
+	lock_acquire (&free_map_lock);
 	ASSERT (bitmap_all (free_map, sector, cnt));
-	bitmap_set_multiple (free_map, sector, cnt, false);
-	bitmap_write (free_map, free_map_file);
+	mark (sector, cnt, false);
+	lock_release (&free_map_lock);
+}
+
+/* Writes the parts of the free map that changed since they were
+ * last written to the free map file. */
+void
+free_map_flush (void) {
+	size_t map_size = bitmap_size (free_map);
+	size_t i;
+
+	lock_acquire (&free_map_lock);
+	if (free_map_file != NULL) {
+		for (i = 0; i < bitmap_size (dirty_map); i++) {
+			size_t start = i * MAP_BITS_PER_SECTOR;
+			size_t cnt = map_size - start < MAP_BITS_PER_SECTOR
+				? map_size - start : MAP_BITS_PER_SECTOR;
+
+			if (!bitmap_test (dirty_map, i))
+				continue;
+			if (!bitmap_write_range (free_map, free_map_file, start, cnt))
+				PANIC ("can't write free map");
+			bitmap_reset (dirty_map, i);
+		}
+		dirty_cnt = 0;
+	}
+	lock_release (&free_map_lock);
+}
+
+/* Returns the number of free map file sectors that the next
+ * free_map_flush() will write.  Read without locking, so that the
+ * journal can call it under its own lock; a stale count is off
+ * only by sectors that file system operations in progress have
+ * changed, which their journal reservations cover. */
+size_t
+free_map_dirty_cnt (void) {
+	return dirty_cnt;
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -50,13 +373,18 @@ free_map_open (void) {
 	free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
 	if (free_map_file == NULL)
 		PANIC ("can't open free map");
+	inode_set_metadata (file_get_inode (free_map_file));
 	if (!bitmap_read (free_map, free_map_file))
 		PANIC ("can't read free map");
+	summarize_all ();
+	bitmap_set_all (dirty_map, false);
+	dirty_cnt = 0;
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) {
+	free_map_flush ();
 	file_close (free_map_file);
 }
 
@@ -65,13 +393,16 @@ free_map_close (void) {
 void
 free_map_create (void) {
 	/* Create inode. */
-	if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+	if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), false))
 		PANIC ("free map creation failed");
 
 	/* Write bitmap to file. */
 	free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
 	if (free_map_file == NULL)
 		PANIC ("can't open free map");
+	inode_set_metadata (file_get_inode (free_map_file));
 	if (!bitmap_write (free_map, free_map_file))
 		PANIC ("can't write free map");
+	bitmap_set_all (dirty_map, false);
+	dirty_cnt = 0;
 }
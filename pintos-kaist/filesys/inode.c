@@ -1,22 +1,70 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#ifdef EFILESYS
+#include "filesys/fat.h"
+#endif
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* A run of LENGTH contiguous data sectors beginning at START.
+ * A file's extents, taken in order, describe its data sectors
+ * from the beginning of the file.  An extent that starts at
+ * HOLE_SECTOR is a hole: that part of the file has no sectors,
+ * reads back as zeros, and is allocated when first written. */
+struct extent {
+	disk_sector_t start;                /* First sector of the run. */
+	uint32_t length;                    /* Number of sectors in the run. */
+};
+
+/* Start of a hole.  Sector 0 holds the free map's inode, so it is
+ * never a file's data. */
+#define HOLE_SECTOR 0
+
+/* Number of extents stored in the inode itself. */
+#define DIRECT_EXTENT_CNT 60
+
+/* Number of extents stored in the indirect extent block. */
+#define INDIRECT_EXTENT_CNT (DISK_SECTOR_SIZE / sizeof (struct extent))
+
+/* Maximum number of extents a single file may have. */
+#define EXTENT_CNT_MAX (DIRECT_EXTENT_CNT + INDIRECT_EXTENT_CNT)
+
+/* A file no longer than INLINE_MAX bytes keeps its data in its
+ * inode sector, in place of the direct extents, and has no data
+ * sectors at all.  It is moved out to a data sector when it
+ * grows past INLINE_MAX. */
+#define INLINE_MAX (DIRECT_EXTENT_CNT * sizeof (struct extent))
+
+/* Inode flags. */
+#define INODE_INLINE 0x1                /* Data is stored inline. */
+#define INODE_DIR 0x2                   /* Holds a directory. */
+
 /* On-disk inode.
  * Must be exactly DISK_SECTOR_SIZE bytes long. */
 struct inode_disk {
-	disk_sector_t start;                /* First data sector. */
 	off_t length;                       /* File size in bytes. */
 	unsigned magic;                     /* Magic number. */
-	uint32_t unused[125];               /* Not used. */
+	uint32_t extent_cnt;                /* Number of extents in use. */
+	disk_sector_t indirect;             /* Indirect extent block, or 0. */
+	disk_sector_t start;                /* First data cluster, on FAT. */
+	uint32_t flags;                     /* INODE_* flags. */
+	uint32_t unused[2];                 /* Not used. */
+	union {
+		struct extent extents[DIRECT_EXTENT_CNT]; /* Direct extents. */
+		uint8_t inline_data[INLINE_MAX];          /* If INODE_INLINE. */
+	};
 };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -28,70 +76,948 @@ bytes_to_sectors (off_t size) {
 
 /* In-memory inode. */
 struct inode {
-	struct list_elem elem;              /* Element in inode list. */
+	struct hash_elem elem;              /* Element in inode table. */
+	struct list_elem lru_elem;          /* Element in closed inode list. */
 	disk_sector_t sector;               /* Sector number of disk location. */
 	int open_cnt;                       /* Number of openers. */
+	bool metadata;                      /* Data goes through the journal? */
+	struct lock lock;                   /* Protects the members below. */
 	bool removed;                       /* True if deleted, false otherwise. */
 	int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+
+	/* Readers share RWLOCK; so do writers that only overwrite data
+	 * already in place, which take OVERWRITE_LOCK among themselves
+	 * so that their partial sectors do not interleave.  Writers that
+	 * may grow the file, fill a hole or change the inode take it
+	 * exclusively.  It guards the data, the on-disk inode and the
+	 * block map.  The lookup hint is shared by concurrent readers
+	 * and so is updated under LOCK instead. */
+	struct rwlock rwlock;
+	struct lock overwrite_lock;
 	struct inode_disk data;             /* Inode content. */
+
+	/* Block map cache. */
+	size_t sector_cnt;                  /* Data sectors allocated. */
+	struct extent *indirect;            /* Indirect extents, or NULL. */
+	size_t hint_idx;                    /* Extent of the last lookup. */
+	size_t hint_base;                   /* File sector at start of HINT_IDX. */
+#ifdef EFILESYS
+	struct fat_chain_cache chain;       /* Positions in the cluster chain. */
+#else
+	disk_sector_t prealloc_start;       /* Sectors reserved past the end. */
+	size_t prealloc_cnt;                /* Number of sectors reserved. */
+#endif
+
+	/* Delayed allocation: file sectors SECTOR_CNT and up, which
+	 * have no disk sectors yet, held in memory. */
+	uint8_t *delayed;                   /* DELAYED_MAX sectors, or NULL. */
+	size_t delayed_cnt;                 /* Sectors of DELAYED in use. */
+	size_t reserved_cnt;                /* Free sectors set aside for them. */
 };
 
+/* Returns true if INODE's data is stored in its inode sector. */
+static inline bool
+is_inline (const struct inode *inode) {
+	return (inode->data.flags & INODE_INLINE) != 0;
+}
+
+/* A file that grows is not given disk sectors as it is written.
+ * Up to DELAYED_MAX sectors of new data are held in the inode and
+ * allocated together when they are written back, as one run, so
+ * files that grow side by side do not interleave on disk.
+ * Write-back happens when the buffer fills and when the file is
+ * closed.  Free space for the sectors is set aside as they enter
+ * the buffer, so that write-back always finds room for them. */
+#define DELAYED_MAX 64
+
+/* When a file fills its delayed buffer, and so is still being
+ * appended to, up to this many sectors past its end are reserved
+ * for the next write-back.  The reservation is given up when the
+ * file is closed. */
+#define PREALLOC_MAX DELAYED_MAX
+
+/* Sectors of zeros written by each command of fill_sectors(). */
+#define ZEROS_SECTORS 8
+
+/* Writes the CNT sectors starting at START on disk from DATA, or
+ * fills them with zeros if DATA is a null pointer. */
+static void
+fill_sectors (disk_sector_t start, size_t cnt, const uint8_t *data) {
+	static uint8_t zeros[ZEROS_SECTORS * DISK_SECTOR_SIZE];
+	enum disk_origin old_origin = disk_set_origin (DISK_DATA);
+
+	if (data != NULL)
+		disk_write_multi (filesys_disk, start, data, cnt);
+	else
+		while (cnt > 0) {
+			size_t chunk = cnt < ZEROS_SECTORS ? cnt : ZEROS_SECTORS;
+			disk_write_multi (filesys_disk, start, zeros, chunk);
+			start += chunk;
+			cnt -= chunk;
+		}
+	disk_set_origin (old_origin);
+}
+
+#ifdef EFILESYS
+/* On FAT, a file's data is a single cluster chain that begins at
+ * the cluster recorded in its inode.  Positions in the chain are
+ * remembered in the inode's chain cache as it is walked. */
+
+/* Returns the disk sector that holds file sector SECTOR_OFS of
+ * INODE, or -1 if INODE has no sector allocated there. */
+static disk_sector_t
+lookup_sector (struct inode *inode, size_t sector_ofs) {
+	cluster_t clst;
+
+	if (sector_ofs >= inode->sector_cnt)
+		return -1;
+	clst = fat_chain_seek (&inode->chain, inode->data.start,
+			sector_ofs / SECTORS_PER_CLUSTER);
+	ASSERT (clst != 0);
+	return cluster_to_sector (clst) + sector_ofs % SECTORS_PER_CLUSTER;
+}
+
+/* Appends clusters to INODE's chain until it holds NEEDED
+ * sectors, filling the new sectors from DATA, or with zeros if
+ * DATA is a null pointer.  Clusters that INODE has reserved are
+ * used first.  Stops early if the disk fills up. */
+static void
+allocate_sectors (struct inode *inode, size_t needed, const uint8_t *data) {
+	size_t first = inode->sector_cnt;
+	cluster_t tail = 0;
+
+	if (inode->sector_cnt > 0)
+		tail = fat_chain_seek (&inode->chain, inode->data.start,
+				inode->sector_cnt / SECTORS_PER_CLUSTER - 1);
+
+	while (inode->sector_cnt < needed) {
+		cluster_t clst;
+
+		if (inode->reserved_cnt > 0) {
+			clst = fat_claim_chain (tail);
+			inode->reserved_cnt -= SECTORS_PER_CLUSTER;
+		} else
+			clst = fat_create_chain (tail);
+		if (clst == 0)
+			break;
+		if (inode->data.start == 0)
+			inode->data.start = clst;
+		fill_sectors (cluster_to_sector (clst), SECTORS_PER_CLUSTER,
+				data != NULL
+				? data + (inode->sector_cnt - first) * DISK_SECTOR_SIZE : NULL);
+		inode->sector_cnt += SECTORS_PER_CLUSTER;
+		tail = clst;
+	}
+}
+
+/* Releases INODE's cluster chain, and forgets its positions. */
+static void
+release_sectors (struct inode *inode) {
+	if (inode->data.start != 0)
+		fat_remove_chain (inode->data.start, 0);
+	fat_chain_cache_destroy (&inode->chain);
+}
+
+/* Sets up the block map of INODE, whose on-disk inode has just
+ * been read.  Returns false if memory is short. */
+static bool
+load_block_map (struct inode *inode) {
+	fat_chain_cache_init (&inode->chain);
+	inode->sector_cnt = 0;
+	if (!is_inline (inode))
+		inode->sector_cnt = ROUND_UP (bytes_to_sectors (inode->data.length),
+				SECTORS_PER_CLUSTER);
+	return true;
+}
+
+/* Frees the memory held by INODE's block map. */
+static void
+free_block_map (struct inode *inode) {
+	fat_chain_cache_destroy (&inode->chain);
+}
+
+/* FAT hands out clusters one at a time from its own cursor, so
+ * there is nothing to reserve ahead. */
+static void
+preallocate (struct inode *inode UNUSED) {
+}
+
+static void
+release_prealloc (struct inode *inode UNUSED) {
+}
+
+static bool
+has_prealloc (const struct inode *inode UNUSED) {
+	return false;
+}
+
+/* Sets aside free clusters for CNT sectors of INODE's delayed
+ * data.  Returns false if the disk does not have that many. */
+static bool
+reserve_delayed (struct inode *inode, size_t cnt) {
+	if (cnt <= inode->reserved_cnt)
+		return true;
+	if (!fat_reserve ((cnt - inode->reserved_cnt) / SECTORS_PER_CLUSTER))
+		return false;
+	inode->reserved_cnt = cnt;
+	return true;
+}
+
+/* Gives back the clusters that INODE has set aside, if any. */
+static void
+release_reserved (struct inode *inode) {
+	if (inode->reserved_cnt > 0)
+		fat_unreserve (inode->reserved_cnt / SECTORS_PER_CLUSTER);
+	inode->reserved_cnt = 0;
+}
+
+/* FAT has no holes, so INODE's chain is extended to NEEDED
+ * sectors with zeroed clusters.  Returns false if the disk fills
+ * up first. */
+static bool
+extend_map (struct inode *inode, size_t needed) {
+	allocate_sectors (inode, needed, NULL);
+	return inode->sector_cnt >= needed;
+}
+
+static size_t
+fill_hole (struct inode *inode UNUSED, size_t sector_ofs UNUSED,
+		size_t cnt UNUSED) {
+	NOT_REACHED ();
+}
+
+/* FAT has no holes, so all of INODE's allocated sectors form one
+ * run of data. */
+static size_t
+run_end (struct inode *inode, size_t sector_ofs UNUSED, bool *in_hole) {
+	*in_hole = false;
+	return inode->sector_cnt;
+}
+#else
+/* Returns the extent numbered IDX within INODE. */
+static struct extent *
+extent_at (struct inode *inode, size_t idx) {
+	ASSERT (idx < inode->data.extent_cnt);
+	if (idx < DIRECT_EXTENT_CNT)
+		return &inode->data.extents[idx];
+	ASSERT (inode->indirect != NULL);
+	return &inode->indirect[idx - DIRECT_EXTENT_CNT];
+}
+
+/* Returns the disk sector that holds file sector SECTOR_OFS of
+ * INODE, HOLE_SECTOR if it falls in a hole, or -1 if it lies past
+ * INODE's block map.
+ * Lookups resume from the extent found last time, so sequential
+ * access costs O(1) per sector. */
+static disk_sector_t
+lookup_sector (struct inode *inode, size_t sector_ofs) {
+	size_t idx = inode->hint_idx;
+	size_t base = inode->hint_base;
+
+	if (sector_ofs >= inode->sector_cnt)
+		return -1;
+	if (sector_ofs < base)
+		idx = base = 0;
+
+	for (; idx < inode->data.extent_cnt; idx++) {
+		struct extent *e = extent_at (inode, idx);
+		if (sector_ofs < base + e->length) {
+			inode->hint_idx = idx;
+			inode->hint_base = base;
+			if (e->start == HOLE_SECTOR)
+				return HOLE_SECTOR;
+			return e->start + (sector_ofs - base);
+		}
+		base += e->length;
+	}
+	NOT_REACHED ();
+}
+
+/* Returns the file sector just past the run of holes, or of
+ * data, that holds file sector SECTOR_OFS of INODE, which must
+ * lie within INODE's block map, and sets *IN_HOLE to whether the
+ * run is a hole.  Steps over whole extents, not sectors. */
+static size_t
+run_end (struct inode *inode, size_t sector_ofs, bool *in_hole) {
+	size_t idx, end;
+
+	lock_acquire (&inode->lock);
+	*in_hole = lookup_sector (inode, sector_ofs) == HOLE_SECTOR;
+	end = inode->hint_base;
+	for (idx = inode->hint_idx; idx < inode->data.extent_cnt; idx++) {
+		struct extent *e = extent_at (inode, idx);
+		if ((e->start == HOLE_SECTOR) != *in_hole)
+			break;
+		end += e->length;
+	}
+	lock_release (&inode->lock);
+	return end;
+}
+
+/* Returns true if extent B can be merged onto the end of A:
+ * both are holes, or B's sectors directly follow A's. */
+static bool
+extent_follows (const struct extent *a, const struct extent *b) {
+	if (a->start == HOLE_SECTOR || b->start == HOLE_SECTOR)
+		return a->start == b->start;
+	return a->start + a->length == b->start;
+}
+
+/* Makes room for INODE to hold CNT extents, setting up its
+ * indirect extent block if CNT needs it.  Returns false if CNT
+ * is too many or memory or disk space is short. */
+static bool
+extent_reserve (struct inode *inode, size_t cnt) {
+	if (cnt > EXTENT_CNT_MAX)
+		return false;
+	if (cnt > DIRECT_EXTENT_CNT && inode->indirect == NULL) {
+		bool reserved = inode->reserved_cnt > 0;
+
+		inode->indirect = calloc (1, DISK_SECTOR_SIZE);
+		if (inode->indirect == NULL)
+			return false;
+		if (reserved ? !free_map_claim (1, &inode->data.indirect)
+				: !free_map_allocate (1, &inode->data.indirect)) {
+			free (inode->indirect);
+			inode->indirect = NULL;
+			return false;
+		}
+		if (reserved)
+			inode->reserved_cnt--;
+	}
+	return true;
+}
+
+/* Appends the CNT sectors starting at START, or a hole of CNT
+ * sectors if START is HOLE_SECTOR, to INODE's extents, merging
+ * them into the last extent when they follow it directly.
+ * Returns false if INODE has no room for another extent. */
+static bool
+extent_append (struct inode *inode, disk_sector_t start, size_t cnt) {
+	struct extent e = { .start = start, .length = cnt };
+	size_t idx = inode->data.extent_cnt;
+
+	if (idx > 0) {
+		struct extent *last = extent_at (inode, idx - 1);
+		if (extent_follows (last, &e)) {
+			last->length += cnt;
+			inode->sector_cnt += cnt;
+			return true;
+		}
+	}
+
+	if (!extent_reserve (inode, idx + 1))
+		return false;
+	inode->data.extent_cnt++;
+	*extent_at (inode, idx) = e;
+	inode->sector_cnt += cnt;
+	return true;
+}
+
+/* Replaces extent IDX of INODE by the CNT extents in PIECES,
+ * which must cover the same part of the file.  Returns false if
+ * INODE has no room for them. */
+static bool
+extent_splice (struct inode *inode, size_t idx,
+		const struct extent *pieces, size_t cnt) {
+	size_t old_cnt = inode->data.extent_cnt;
+	size_t new_cnt = old_cnt - 1 + cnt;
+	size_t i;
+
+	if (!extent_reserve (inode, new_cnt))
+		return false;
+
+	if (cnt > 1) {
+		inode->data.extent_cnt = new_cnt;
+		for (i = new_cnt - 1; i >= idx + cnt; i--)
+			*extent_at (inode, i) = *extent_at (inode, i - (cnt - 1));
+	} else if (cnt == 0) {
+		for (i = idx; i < new_cnt; i++)
+			*extent_at (inode, i) = *extent_at (inode, i + 1);
+		inode->data.extent_cnt = new_cnt;
+	}
+	for (i = 0; i < cnt; i++)
+		*extent_at (inode, idx + i) = pieces[i];
+
+	inode->hint_idx = inode->hint_base = 0;
+	return true;
+}
+
+/* Allocates up to CNT free sectors, beginning at GOAL if it is
+ * free, and otherwise taking the largest free run that is no
+ * longer than CNT.  The sectors come out of a reservation made
+ * with free_map_reserve() if RESERVED is true.  Stores the first
+ * sector in *SECTORP and returns the number allocated, or 0 if
+ * the disk is full. */
+static size_t
+allocate_near (disk_sector_t goal, size_t cnt, disk_sector_t *sectorp,
+		bool reserved) {
+	if (goal != HOLE_SECTOR) {
+		size_t got = reserved ? free_map_claim_at (goal, cnt)
+			: free_map_allocate_at (goal, cnt);
+		if (got > 0) {
+			*sectorp = goal;
+			return got;
+		}
+	}
+
+	for (; cnt > 0; cnt /= 2)
+		if (reserved ? free_map_claim (cnt, sectorp)
+				: free_map_allocate (cnt, sectorp))
+			return cnt;
+	return 0;
+}
+
+/* Allocates up to CNT free sectors for INODE, preferring the
+ * sectors that directly follow its last extent so that its data
+ * stays contiguous, and falling back to the largest free run
+ * that is no longer than CNT.  Stores the first sector in
+ * *SECTORP and returns the number allocated, or 0 if the disk is
+ * full. */
+static size_t
+allocate_run (struct inode *inode, size_t cnt, disk_sector_t *sectorp) {
+	disk_sector_t goal = HOLE_SECTOR;
+	bool reserved = inode->reserved_cnt > 0;
+	size_t got;
+
+	/* Space reserved by preallocate() comes first, then space
+	 * set aside by reserve_delayed(). */
+	if (inode->prealloc_cnt > 0) {
+		if (cnt > inode->prealloc_cnt)
+			cnt = inode->prealloc_cnt;
+		*sectorp = inode->prealloc_start;
+		inode->prealloc_start += cnt;
+		inode->prealloc_cnt -= cnt;
+		return cnt;
+	}
+	if (reserved && cnt > inode->reserved_cnt)
+		cnt = inode->reserved_cnt;
+
+	if (inode->data.extent_cnt > 0) {
+		struct extent *last = extent_at (inode, inode->data.extent_cnt - 1);
+		if (last->start != HOLE_SECTOR)
+			goal = last->start + last->length;
+	}
+	got = allocate_near (goal, cnt, sectorp, reserved);
+	if (reserved)
+		inode->reserved_cnt -= got;
+	return got;
+}
+
+/* Allocates data sectors for INODE until it holds NEEDED of
+ * them, filling the new sectors from DATA, or with zeros if DATA
+ * is a null pointer.  Stops early if the disk fills up. */
+static void
+allocate_sectors (struct inode *inode, size_t needed, const uint8_t *data) {
+	size_t first = inode->sector_cnt;
+
+	while (inode->sector_cnt < needed) {
+		disk_sector_t start;
+		size_t cnt, ofs;
+
+		cnt = allocate_run (inode, needed - inode->sector_cnt, &start);
+		if (cnt == 0)
+			break;
+		ofs = inode->sector_cnt - first;
+		if (!extent_append (inode, start, cnt)) {
+			free_map_release (start, cnt);
+			break;
+		}
+		fill_sectors (start, cnt,
+				data != NULL ? data + ofs * DISK_SECTOR_SIZE : NULL);
+	}
+}
+
+/* Reserves up to PREALLOC_MAX free sectors directly after INODE's
+ * last extent, for a file that is still being appended to. */
+static void
+preallocate (struct inode *inode) {
+	struct extent *last;
+
+	if (inode->prealloc_cnt > 0 || inode->data.extent_cnt == 0)
+		return;
+	last = extent_at (inode, inode->data.extent_cnt - 1);
+	if (last->start == HOLE_SECTOR)
+		return;
+	inode->prealloc_start = last->start + last->length;
+	inode->prealloc_cnt = free_map_allocate_at (inode->prealloc_start,
+			PREALLOC_MAX);
+}
+
+/* Gives up the sectors that INODE has reserved, if any. */
+static void
+release_prealloc (struct inode *inode) {
+	if (inode->prealloc_cnt > 0)
+		free_map_release (inode->prealloc_start, inode->prealloc_cnt);
+	inode->prealloc_cnt = 0;
+}
+
+/* Returns true if INODE has sectors reserved by preallocate(). */
+static bool
+has_prealloc (const struct inode *inode) {
+	return inode->prealloc_cnt > 0;
+}
+
+/* Sets aside free sectors for CNT sectors of INODE's delayed
+ * data, beyond those that preallocate() already holds, and one
+ * more for the indirect extent block that write-back may need.
+ * Returns false if the disk does not have that many. */
+static bool
+reserve_delayed (struct inode *inode, size_t cnt) {
+	size_t want = cnt > inode->prealloc_cnt ? cnt - inode->prealloc_cnt : 0;
+
+	if (inode->indirect == NULL)
+		want++;
+	if (want <= inode->reserved_cnt)
+		return true;
+	if (!free_map_reserve (want - inode->reserved_cnt))
+		return false;
+	inode->reserved_cnt = want;
+	return true;
+}
+
+/* Gives back the free sectors that INODE has set aside, if any. */
+static void
+release_reserved (struct inode *inode) {
+	if (inode->reserved_cnt > 0)
+		free_map_unreserve (inode->reserved_cnt);
+	inode->reserved_cnt = 0;
+}
+
+/* Extends INODE's block map to NEEDED sectors by appending a hole,
+ * so that nothing is allocated or written until data is.  Returns
+ * false if INODE has no room for another extent. */
+static bool
+extend_map (struct inode *inode, size_t needed) {
+	if (needed <= inode->sector_cnt)
+		return true;
+	return extent_append (inode, HOLE_SECTOR, needed - inode->sector_cnt);
+}
+
+/* Allocates disk sectors for up to CNT file sectors of INODE
+ * starting at SECTOR_OFS, which must lie in a hole, stopping at
+ * the end of the hole.  The new sectors are not written.
+ * Returns the number of file sectors allocated, which is 0 if the
+ * disk or INODE's extent table is full. */
+static size_t
+fill_hole (struct inode *inode, size_t sector_ofs, size_t cnt) {
+	struct extent pieces[3], *e, *prev = NULL;
+	disk_sector_t goal = HOLE_SECTOR, start;
+	size_t idx, before, got, n = 0;
+
+	lookup_sector (inode, sector_ofs);
+	idx = inode->hint_idx;
+	e = extent_at (inode, idx);
+	ASSERT (e->start == HOLE_SECTOR);
+
+	before = sector_ofs - inode->hint_base;
+	if (cnt > e->length - before)
+		cnt = e->length - before;
+
+	/* Continue the data just ahead of the hole, if any. */
+	if (before == 0 && idx > 0) {
+		prev = extent_at (inode, idx - 1);
+		if (prev->start != HOLE_SECTOR)
+			goal = prev->start + prev->length;
+	}
+	got = allocate_near (goal, cnt, &start, false);
+	if (got == 0)
+		return 0;
+
+	if (before > 0)
+		pieces[n++] = (struct extent) { HOLE_SECTOR, before };
+	pieces[n++] = (struct extent) { start, got };
+	if (before + got < e->length)
+		pieces[n++] = (struct extent) { HOLE_SECTOR, e->length - before - got };
+
+	if (prev != NULL && extent_follows (prev, &pieces[0])) {
+		prev->length += got;
+		if (!extent_splice (inode, idx, pieces + 1, n - 1)) {
+			prev->length -= got;
+			free_map_release (start, got);
+			return 0;
+		}
+	} else if (!extent_splice (inode, idx, pieces, n)) {
+		free_map_release (start, got);
+		return 0;
+	}
+	return got;
+}
+
+/* Releases every data sector of INODE, along with its indirect
+ * extent block. */
+static void
+release_sectors (struct inode *inode) {
+	size_t i;
+
+	for (i = 0; i < inode->data.extent_cnt; i++) {
+		struct extent *e = extent_at (inode, i);
+		if (e->start != HOLE_SECTOR)
+			free_map_release (e->start, e->length);
+	}
+	if (inode->indirect != NULL)
+		free_map_release (inode->data.indirect, 1);
+}
+
+/* Sets up the block map of INODE, whose on-disk inode has just
+ * been read, by loading its indirect extent block if it has one.
+ * Returns false if memory is short. */
+static bool
+load_block_map (struct inode *inode) {
+	size_t i;
+
+	inode->indirect = NULL;
+	inode->hint_idx = inode->hint_base = 0;
+	inode->prealloc_cnt = 0;
+	if (inode->data.extent_cnt > DIRECT_EXTENT_CNT) {
+		inode->indirect = malloc (DISK_SECTOR_SIZE);
+		if (inode->indirect == NULL)
+			return false;
+		journal_read (inode->data.indirect, inode->indirect);
+	}
+
+	inode->sector_cnt = 0;
+	for (i = 0; i < inode->data.extent_cnt; i++)
+		inode->sector_cnt += extent_at (inode, i)->length;
+	return true;
+}
+
+/* Frees the memory held by INODE's block map. */
+static void
+free_block_map (struct inode *inode) {
+	free (inode->indirect);
+	inode->indirect = NULL;
+}
+#endif /* EFILESYS */
+
 /* Returns the disk sector that contains byte offset POS within
  * INODE.
  * Returns -1 if INODE does not contain data for a byte at offset
  * POS. */
 static disk_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) {
+byte_to_sector (struct inode *inode, off_t pos) {
 	ASSERT (inode != NULL);
-	if (pos < inode->data.length)
-		return inode->data.start + pos / DISK_SECTOR_SIZE;
-	else
+	disk_sector_t sector;
+
+	if (pos >= inode->data.length)
 		return -1;
+
+	lock_acquire (&inode->lock);
+	sector = lookup_sector (inode, pos / DISK_SECTOR_SIZE);
+	lock_release (&inode->lock);
+	return sector;
+}
+
+/* Writes INODE's on-disk inode, and its indirect extent block if
+ * it has one, back to disk.  Delayed data is not on disk yet, so
+ * the length written stops at the allocated sectors.  Inline data
+ * is part of the inode and is written with it. */
+static void
+inode_flush (struct inode *inode) {
+	off_t allocated = inode->sector_cnt * DISK_SECTOR_SIZE;
+
+	if (inode->data.length > allocated && !is_inline (inode)) {
+		struct inode_disk data = inode->data;
+		data.length = allocated;
+		journal_write (inode->sector, &data);
+	} else
+		journal_write (inode->sector, &inode->data);
+	if (inode->indirect != NULL)
+		journal_write (inode->data.indirect, inode->indirect);
+}
+
+/* Extends INODE to LENGTH bytes and writes the inode back to
+ * disk.  The new part of the file is a hole, which costs no disk
+ * writes; on FAT, which has no holes, zeroed sectors are
+ * allocated instead.  If that fails, INODE is extended only as far
+ * as its block map reaches.  Returns true if INODE is now LENGTH
+ * bytes long. */
+static bool
+inode_grow (struct inode *inode, off_t length) {
+	size_t needed = bytes_to_sectors (length);
+
+	ASSERT (inode->delayed_cnt == 0);
+	extend_map (inode, needed);
+
+	if (length > (off_t) (inode->sector_cnt * DISK_SECTOR_SIZE))
+		length = inode->sector_cnt * DISK_SECTOR_SIZE;
+	if (length > inode->data.length)
+		inode->data.length = length;
+	inode_flush (inode);
+	return inode->sector_cnt >= needed;
+}
+
+/* Moves the data of inline INODE out to a data sector of its
+ * own, so that INODE can grow past INLINE_MAX bytes, and writes
+ * INODE back.  Returns false, leaving INODE inline, if the disk
+ * is full. */
+static bool
+inode_promote (struct inode *inode) {
+	size_t cnt = bytes_to_sectors (inode->data.length);
+	uint8_t *data = NULL;
+
+	ASSERT (is_inline (inode));
+	ASSERT (inode->sector_cnt == 0);
+
+	if (cnt > 0) {
+		data = calloc (1, DISK_SECTOR_SIZE);
+		if (data == NULL)
+			return false;
+		memcpy (data, inode->data.inline_data, inode->data.length);
+	}
+
+	inode->data.flags &= ~INODE_INLINE;
+	memset (inode->data.inline_data, 0, INLINE_MAX);
+	inode->data.extent_cnt = 0;
+	if (cnt > 0) {
+		allocate_sectors (inode, cnt, data);
+		if (inode->sector_cnt < cnt) {
+			/* Nothing was allocated: go back to inline. */
+			inode->data.flags |= INODE_INLINE;
+			memcpy (inode->data.inline_data, data, inode->data.length);
+		}
+		free (data);
+	}
+	if (is_inline (inode))
+		return false;
+	inode_flush (inode);
+	return true;
 }
 
-/* List of open inodes, so that opening a single inode twice
- * returns the same `struct inode'. */
-static struct list open_inodes;
+/* Allocates disk sectors for INODE's delayed data, all in one
+ * go, out of the space that reserve_delayed() set aside for it,
+ * and writes the data and the inode to disk.  Running out of
+ * extents is the only way for the data not to fit, in which case
+ * the part that did not fit is lost and INODE is cut short. */
+static void
+inode_writeback (struct inode *inode) {
+	off_t allocated;
+
+	if (inode->delayed_cnt == 0)
+		return;
+
+	allocate_sectors (inode, inode->sector_cnt + inode->delayed_cnt,
+			inode->delayed);
+	release_reserved (inode);
+	inode->delayed_cnt = 0;
+	allocated = inode->sector_cnt * DISK_SECTOR_SIZE;
+	if (inode->data.length > allocated)
+		inode->data.length = allocated;
+	inode_flush (inode);
+}
+
+/* Extends INODE to LENGTH bytes ahead of a write that starts at
+ * OFFSET.  New sectors go to the delayed buffer while they fit
+ * and the disk has room for them; otherwise the buffer is
+ * written back first, the sectors that the write skips over
+ * become a hole, and sectors that still do not fit become a hole
+ * too, to be filled by the write itself, which comes up short if
+ * the disk is full. */
+static void
+inode_extend (struct inode *inode, off_t offset, off_t length) {
+	size_t needed = bytes_to_sectors (length);
+	size_t first = offset / DISK_SECTOR_SIZE;
+	size_t cnt;
+
+	/* Metadata is journaled, which the delayed buffer bypasses. */
+	if (inode->metadata) {
+		inode_grow (inode, length);
+		return;
+	}
+
+	if (needed > inode->sector_cnt + DELAYED_MAX) {
+		if (inode->delayed_cnt > 0) {
+			inode_writeback (inode);
+			preallocate (inode);
+		}
+		if (first > inode->sector_cnt)
+			inode_grow (inode, first * DISK_SECTOR_SIZE);
+		if (needed > inode->sector_cnt + DELAYED_MAX) {
+			inode_grow (inode, length);
+			return;
+		}
+	}
+
+	if (needed > inode->sector_cnt) {
+		if (inode->delayed == NULL) {
+			inode->delayed = malloc (DELAYED_MAX * DISK_SECTOR_SIZE);
+			if (inode->delayed == NULL) {
+				inode_grow (inode, length);
+				return;
+			}
+		}
+		cnt = needed - inode->sector_cnt;
+		if (cnt > inode->delayed_cnt) {
+			if (!reserve_delayed (inode, cnt)) {
+				inode_writeback (inode);
+				inode_grow (inode, length);
+				return;
+			}
+			memset (inode->delayed + inode->delayed_cnt * DISK_SECTOR_SIZE, 0,
+					(cnt - inode->delayed_cnt) * DISK_SECTOR_SIZE);
+			inode->delayed_cnt = cnt;
+		}
+	}
+
+	inode->data.length = length;
+	if (inode->delayed_cnt == 0)
+		inode_flush (inode);
+}
+
+/* Returns the delayed buffer of INODE for file sector SECTOR_OFS,
+ * which must lie past INODE's allocated sectors. */
+static uint8_t *
+delayed_sector (struct inode *inode, size_t sector_ofs) {
+	ASSERT (sector_ofs >= inode->sector_cnt);
+	ASSERT (sector_ofs < inode->sector_cnt + inode->delayed_cnt);
+	return inode->delayed + (sector_ofs - inode->sector_cnt) * DISK_SECTOR_SIZE;
+}
+
+/* Reads data sector SECTOR of INODE into BUFFER.  The newest
+ * version of a metadata sector may still be in the journal. */
+static void
+data_read (const struct inode *inode, disk_sector_t sector, void *buffer) {
+	if (inode->metadata)
+		journal_read (sector, buffer);
+	else {
+		enum disk_origin old_origin = disk_set_origin (DISK_DATA);
+		disk_read (filesys_disk, sector, buffer);
+		disk_set_origin (old_origin);
+	}
+}
+
+/* Writes BUFFER to data sector SECTOR of INODE, through the
+ * journal if INODE holds metadata. */
+static void
+data_write (const struct inode *inode, disk_sector_t sector,
+		const void *buffer) {
+	if (inode->metadata)
+		journal_write (sector, buffer);
+	else {
+		enum disk_origin old_origin = disk_set_origin (DISK_DATA);
+		disk_write (filesys_disk, sector, buffer);
+		disk_set_origin (old_origin);
+	}
+}
+
+/* Table of in-memory inodes, keyed by sector, so that opening a
+ * single inode twice returns the same `struct inode'.
+ *
+ * When its last opener closes an inode that was not removed, the
+ * inode stays in the table and goes on closed_inodes, so that
+ * opening it again does not read the disk.  At most
+ * CLOSED_INODE_MAX such inodes are kept; past that the least
+ * recently closed one is freed.  An inode's delayed data is
+ * written back when it is closed, so a closed inode can be freed
+ * at any time.
+ *
+ * inode_table_lock protects the table, closed_inodes and each
+ * inode's OPEN_CNT.  It is never held during disk I/O.  Each
+ * inode's own LOCK protects the rest of it; acquire
+ * inode_table_lock first if both are needed. */
+static struct hash inode_table;
+static struct list closed_inodes;
+static size_t closed_inode_cnt;
+static struct lock inode_table_lock;
+#define CLOSED_INODE_MAX 64
+
+/* Incremented whenever an inode leaves the table. */
+static unsigned long inode_release_cnt;
+
+static uint64_t inode_hash (const struct hash_elem *e, void *aux UNUSED);
+static bool inode_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED);
 
 /* Initializes the inode module. */
 void
 inode_init (void) {
-	list_init (&open_inodes);
+	hash_init (&inode_table, inode_hash, inode_less, NULL);
+	list_init (&closed_inodes);
+	closed_inode_cnt = 0;
+	lock_init (&inode_table_lock);
+}
+
+/* Returns the inode for SECTOR in the inode table, with a new
+ * reference taken, or a null pointer if there is none.
+ * Must be called with inode_table_lock held. */
+static struct inode *
+table_get (disk_sector_t sector) {
+	struct inode key;
+	struct hash_elem *e;
+	struct inode *inode;
+
+	key.sector = sector;
+	e = hash_find (&inode_table, &key.elem);
+	if (e == NULL)
+		return NULL;
+
+	inode = hash_entry (e, struct inode, elem);
+	if (inode->open_cnt++ == 0) {
+		list_remove (&inode->lru_elem);
+		closed_inode_cnt--;
+	}
+	return inode;
+}
+
+/* Frees INODE, which is no longer in the inode table, releasing
+ * its blocks if it was removed. */
+static void
+inode_free (struct inode *inode) {
+	if (inode->removed) {
+#ifdef EFILESYS
+		fat_remove_chain (sector_to_cluster (inode->sector), 0);
+#else
+		free_map_release (inode->sector, 1);
+#endif
+		release_sectors (inode);
+	}
+
+	release_reserved (inode);
+	free_block_map (inode);
+	free (inode->delayed);
+	free (inode);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
  * writes the new inode to sector SECTOR on the file system
- * disk.
+ * disk.  IS_DIR marks it as holding a directory, whose data is
+ * metadata and goes through the journal.
  * Returns true if successful.
  * Returns false if memory or disk allocation fails. */
 bool
-inode_create (disk_sector_t sector, off_t length) {
-	struct inode_disk *disk_inode = NULL;
+inode_create (disk_sector_t sector, off_t length, bool is_dir) {
+	struct inode *inode = NULL;
 	bool success = false;
 
 	ASSERT (length >= 0);
 
 	/* If this assertion fails, the inode structure is not exactly
 	 * one sector in size, and you should fix that. */
-	ASSERT (sizeof *disk_inode == DISK_SECTOR_SIZE);
-
-	disk_inode = calloc (1, sizeof *disk_inode);
-	if (disk_inode != NULL) {
-		size_t sectors = bytes_to_sectors (length);
-		disk_inode->length = length;
-		disk_inode->magic = INODE_MAGIC;
-		if (free_map_allocate (sectors, &disk_inode->start)) {
-			disk_write (filesys_disk, sector, disk_inode);
-			if (sectors > 0) {
-				static char zeros[DISK_SECTOR_SIZE];
-				size_t i;
-
-				for (i = 0; i < sectors; i++) 
-					disk_write (filesys_disk, disk_inode->start + i, zeros); 
-			}
-			success = true; 
-		} 
-		free (disk_inode);
+	ASSERT (sizeof inode->data == DISK_SECTOR_SIZE);
+
+	inode = calloc (1, sizeof *inode);
+	if (inode != NULL) {
+		inode->sector = sector;
+		inode->data.magic = INODE_MAGIC;
+		if (is_dir)
+			inode->data.flags = INODE_DIR;
+		inode->metadata = is_dir;
+		journal_begin ();
+		if (length <= (off_t) INLINE_MAX) {
+			/* Small enough to keep in the inode sector, which
+			 * calloc() has already zeroed. */
+			inode->data.flags |= INODE_INLINE;
+			inode->data.length = length;
+			inode_flush (inode);
+			success = true;
+		} else if (load_block_map (inode)) {
+			success = inode_grow (inode, length);
+			if (!success)
+				release_sectors (inode);
+			free_block_map (inode);
+		}
+		journal_end ();
+		free (inode);
 	}
 	return success;
 }
@@ -101,42 +1027,86 @@ inode_create (disk_sector_t sector, off_t length) {
  * Returns a null pointer if memory allocation fails. */
 struct inode *
 inode_open (disk_sector_t sector) {
-	struct list_elem *e;
-	struct inode *inode;
+	struct inode *inode, *cached;
+	unsigned long release_cnt;
 
-	/* Check whether this inode is already open. */
-	for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-			e = list_next (e)) {
-		inode = list_entry (e, struct inode, elem);
-		if (inode->sector == sector) {
-			inode_reopen (inode);
-			return inode; 
-		}
-	}
+	/* Check whether this inode is already open or cached. */
+	lock_acquire (&inode_table_lock);
+	inode = table_get (sector);
+	release_cnt = inode_release_cnt;
+	lock_release (&inode_table_lock);
+	if (inode != NULL)
+		return inode;
 
 	/* Allocate memory. */
 	inode = malloc (sizeof *inode);
 	if (inode == NULL)
 		return NULL;
 
-	/* Initialize. */
-	list_push_front (&open_inodes, &inode->elem);
+	/* Initialize, reading the disk without holding the table
+	 * lock. */
 	inode->sector = sector;
 	inode->open_cnt = 1;
+	lock_init (&inode->lock);
+	rwlock_init (&inode->rwlock);
+	lock_init (&inode->overwrite_lock);
 	inode->deny_write_cnt = 0;
 	inode->removed = false;
-	disk_read (filesys_disk, inode->sector, &inode->data);
+	inode->delayed = NULL;
+	inode->delayed_cnt = 0;
+	inode->reserved_cnt = 0;
+	journal_read (inode->sector, &inode->data);
+	inode->metadata = (inode->data.flags & INODE_DIR) != 0;
+	if (!load_block_map (inode)) {
+		free (inode);
+		return NULL;
+	}
+
+	/* Someone else may have opened the inode meanwhile, or opened,
+	 * changed and released it, in which case what we read may be
+	 * stale. */
+	lock_acquire (&inode_table_lock);
+	cached = table_get (sector);
+	if (cached == NULL && release_cnt == inode_release_cnt)
+		hash_insert (&inode_table, &inode->elem);
+	lock_release (&inode_table_lock);
+
+	if (cached != NULL || release_cnt != inode_release_cnt) {
+		free_block_map (inode);
+		free (inode);
+		if (cached == NULL)
+			cached = inode_open (sector);
+		return cached;
+	}
 	return inode;
 }
 
 /* Reopens and returns INODE. */
 struct inode *
 inode_reopen (struct inode *inode) {
-	if (inode != NULL)
+	if (inode != NULL) {
+		lock_acquire (&inode_table_lock);
 		inode->open_cnt++;
+		lock_release (&inode_table_lock);
+	}
 	return inode;
 }
 
+/* Marks INODE as holding file system metadata, so that its data
+ * is written through the journal.  Directories are marked so on
+ * disk when they are created; this is for the free map, which
+ * stays open as long as the file system does. */
+void
+inode_set_metadata (struct inode *inode) {
+	inode->metadata = true;
+}
+
+/* Returns true if INODE holds a directory. */
+bool
+inode_is_dir (const struct inode *inode) {
+	return (inode->data.flags & INODE_DIR) != 0;
+}
+
 /* Returns INODE's inode number. */
 disk_sector_t
 inode_get_inumber (const struct inode *inode) {
@@ -144,27 +1114,97 @@ inode_get_inumber (const struct inode *inode) {
 }
 
 /* Closes INODE and writes it to disk.
- * If this was the last reference to INODE, frees its memory.
+ * If this was the last reference to INODE, frees its memory
+ * (possibly later, after keeping it cached for a while).
  * If INODE was also a removed inode, frees its blocks. */
 void
 inode_close (struct inode *inode) {
+	struct inode *victim = NULL;
+	bool journaled = false;
+	bool removed;
+
 	/* Ignore null pointer. */
 	if (inode == NULL)
 		return;
 
-	/* Release resources if this was the last opener. */
-	if (--inode->open_cnt == 0) {
-		/* Remove from inode list and release lock. */
-		list_remove (&inode->elem);
+	/* Write back delayed data and give up reserved sectors.  Only
+	 * that changes the disk, so an inode that has neither is closed
+	 * without a journal transaction. */
+	rwlock_acquire_write (&inode->rwlock);
+	if (inode->delayed_cnt > 0 || has_prealloc (inode)) {
+		rwlock_release_write (&inode->rwlock);
+		journal_begin ();
+		journaled = true;
+		rwlock_acquire_write (&inode->rwlock);
+	}
+	lock_acquire (&inode->lock);
+	removed = inode->removed;
+	lock_release (&inode->lock);
+	if (journaled) {
+		if (!removed)
+			inode_writeback (inode);
+		release_prealloc (inode);
+	}
+	rwlock_release_write (&inode->rwlock);
 
-		/* Deallocate blocks if removed. */
+	lock_acquire (&inode_table_lock);
+	if (--inode->open_cnt == 0) {
 		if (inode->removed) {
-			free_map_release (inode->sector, 1);
-			free_map_release (inode->data.start,
-					bytes_to_sectors (inode->data.length)); 
+			/* Remove from inode table, to be freed below. */
+			hash_delete (&inode_table, &inode->elem);
+			inode_release_cnt++;
+			victim = inode;
+		} else {
+			/* Keep it cached, evicting the oldest if too many. */
+			list_push_front (&closed_inodes, &inode->lru_elem);
+			if (++closed_inode_cnt > CLOSED_INODE_MAX) {
+				victim = list_entry (list_pop_back (&closed_inodes),
+						struct inode, lru_elem);
+				closed_inode_cnt--;
+				hash_delete (&inode_table, &victim->elem);
+				inode_release_cnt++;
+			}
 		}
+	}
+	lock_release (&inode_table_lock);
 
-		free (inode); 
+	/* Release resources outside the table lock.  Freeing a removed
+	 * inode's sectors changes the disk. */
+	if (victim != NULL) {
+		if (victim->removed && !journaled) {
+			journal_begin ();
+			journaled = true;
+		}
+		inode_free (victim);
+	}
+
+	if (journaled)
+		journal_end ();
+}
+
+/* Writes back the delayed data of every open inode.  Called at
+ * shutdown, for files that are still open then. */
+void
+inode_sync_all (void) {
+	for (;;) {
+		struct inode *inode = NULL;
+		struct hash_iterator i;
+
+		lock_acquire (&inode_table_lock);
+		hash_first (&i, &inode_table);
+		while (hash_next (&i)) {
+			struct inode *cand = hash_entry (hash_cur (&i), struct inode, elem);
+			if (cand->delayed_cnt > 0 && !cand->removed) {
+				inode = cand;
+				inode->open_cnt++;
+				break;
+			}
+		}
+		lock_release (&inode_table_lock);
+
+		if (inode == NULL)
+			break;
+		inode_close (inode);
 	}
 }
 
@@ -173,18 +1213,31 @@ inode_close (struct inode *inode) {
 void
 inode_remove (struct inode *inode) {
 	ASSERT (inode != NULL);
+	lock_acquire (&inode->lock);
 	inode->removed = true;
+	lock_release (&inode->lock);
 }
 
-/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
- * Returns the number of bytes actually read, which may be less
- * than SIZE if an error occurs or end of file is reached. */
-off_t
-inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
+/* Reads SIZE bytes from INODE into kernel BUFFER, starting at
+ * position OFFSET, holding INODE's rwlock for reading throughout.
+ * Returns the number of bytes actually read. */
+static off_t
+read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 	uint8_t *buffer = buffer_;
 	off_t bytes_read = 0;
 	uint8_t *bounce = NULL;
 
+	rwlock_acquire_read (&inode->rwlock);
+	if (is_inline (inode)) {
+		/* The data is in the inode, which is already in memory. */
+		if (offset < inode_length (inode)) {
+			bytes_read = inode_length (inode) - offset;
+			if (bytes_read > size)
+				bytes_read = size;
+			memcpy (buffer, inode->data.inline_data + offset, bytes_read);
+		}
+		size = 0;
+	}
 	while (size > 0) {
 		/* Disk sector to read, starting byte offset within sector. */
 		disk_sector_t sector_idx = byte_to_sector (inode, offset);
@@ -200,9 +1253,17 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 		if (chunk_size <= 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
+		if ((size_t) offset / DISK_SECTOR_SIZE >= inode->sector_cnt) {
+			/* Not written back yet: copy out of the delayed buffer. */
+			memcpy (buffer + bytes_read,
+					delayed_sector (inode, offset / DISK_SECTOR_SIZE) + sector_ofs,
+					chunk_size);
+		} else if (sector_idx == HOLE_SECTOR) {
+			/* A hole reads back as zeros. */
+			memset (buffer + bytes_read, 0, chunk_size);
+		} else if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
 			/* Read full sector directly into caller's buffer. */
-			disk_read (filesys_disk, sector_idx, buffer + bytes_read); 
+			data_read (inode, sector_idx, buffer + bytes_read);
 		} else {
 			/* Read sector into bounce buffer, then partially copy
 			 * into caller's buffer. */
@@ -211,7 +1272,7 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 				if (bounce == NULL)
 					break;
 			}
-			disk_read (filesys_disk, sector_idx, bounce);
+			data_read (inode, sector_idx, bounce);
 			memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
 		}
 
@@ -220,29 +1281,88 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 		offset += chunk_size;
 		bytes_read += chunk_size;
 	}
+	rwlock_release_read (&inode->rwlock);
 	free (bounce);
 
 	return bytes_read;
 }
 
-/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
- * Returns the number of bytes actually written, which may be
- * less than SIZE if end of file is reached or an error occurs.
- * (Normally a write at end of file would extend the inode, but
- * growth is not yet implemented.) */
-off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+/* Returns true if writing SIZE bytes at OFFSET in INODE only
+ * overwrites data that is already in place, on disk or in the
+ * delayed buffer, so that neither the inode nor its block map
+ * changes.  INODE's rwlock must be held. */
+static bool
+is_overwrite (struct inode *inode, off_t size, off_t offset) {
+	size_t pos = offset / DISK_SECTOR_SIZE;
+	size_t end = bytes_to_sectors (offset + size);
+
+	if (is_inline (inode) || inode->metadata
+			|| offset + size > inode_length (inode))
+		return false;
+	while (pos < end && pos < inode->sector_cnt) {
+		bool in_hole;
+
+		pos = run_end (inode, pos, &in_hole);
+		if (in_hole)
+			return false;
+	}
+	return true;
+}
+
+/* Writes SIZE bytes from kernel BUFFER into INODE, starting at
+ * OFFSET.  An overwrite of data already in place needs no journal
+ * transaction and shares INODE's rwlock with readers; any other
+ * write holds the rwlock for writing throughout.  Returns the
+ * number of bytes actually written. */
+static off_t
+write_at (struct inode *inode, const void *buffer_, off_t size,
 		off_t offset) {
 	const uint8_t *buffer = buffer_;
 	off_t bytes_written = 0;
 	uint8_t *bounce = NULL;
+	size_t fresh_start = 0, fresh_end = 0;
+	bool remapped = false;
+	bool shared;
 
-	if (inode->deny_write_cnt)
+	lock_acquire (&inode->lock);
+	if (inode->deny_write_cnt) {
+		lock_release (&inode->lock);
 		return 0;
+	}
+	lock_release (&inode->lock);
+
+	rwlock_acquire_read (&inode->rwlock);
+	shared = is_overwrite (inode, size, offset);
+	if (shared)
+		lock_acquire (&inode->overwrite_lock);
+	else {
+		rwlock_release_read (&inode->rwlock);
+		journal_begin ();
+		rwlock_acquire_write (&inode->rwlock);
+	}
+
+	if (is_inline (inode)) {
+		if (offset + size <= (off_t) INLINE_MAX) {
+			/* Still fits: update the inode sector only.  Bytes
+			 * past the old end are already zero. */
+			memcpy (inode->data.inline_data + offset, buffer, size);
+			if (offset + size > inode_length (inode))
+				inode->data.length = offset + size;
+			inode_flush (inode);
+			bytes_written = size;
+			size = 0;
+		} else if (!inode_promote (inode))
+			size = 0;
+	}
+
+	/* Extend the file first if the write runs past its end. */
+	if (size > 0 && offset + size > inode_length (inode))
+		inode_extend (inode, offset, offset + size);
 
 	while (size > 0) {
 		/* Sector to write, starting byte offset within sector. */
 		disk_sector_t sector_idx = byte_to_sector (inode, offset);
+		size_t sector_pos = offset / DISK_SECTOR_SIZE;
 		int sector_ofs = offset % DISK_SECTOR_SIZE;
 
 		/* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -255,9 +1375,30 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		if (chunk_size <= 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
+		if (sector_idx == HOLE_SECTOR) {
+			ASSERT (!shared);
+
+			/* Allocate sectors for as much of the rest of the write
+			 * as falls in this hole.  They hold stale data, so a
+			 * partial write to one of them starts from zeros. */
+			size_t got = fill_hole (inode, sector_pos,
+					bytes_to_sectors (offset + size) - sector_pos);
+			if (got == 0)
+				break;
+			fresh_start = sector_pos;
+			fresh_end = sector_pos + got;
+			remapped = true;
+			sector_idx = byte_to_sector (inode, offset);
+		}
+
+		if (sector_pos >= inode->sector_cnt) {
+			/* No disk sector yet: keep the data in the delayed
+			 * buffer until write-back. */
+			memcpy (delayed_sector (inode, sector_pos) + sector_ofs,
+					buffer + bytes_written, chunk_size);
+		} else if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
 			/* Write full sector directly to disk. */
-			disk_write (filesys_disk, sector_idx, buffer + bytes_written); 
+			data_write (inode, sector_idx, buffer + bytes_written);
 		} else {
 			/* We need a bounce buffer. */
 			if (bounce == NULL) {
@@ -269,12 +1410,13 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 			/* If the sector contains data before or after the chunk
 			   we're writing, then we need to read in the sector
 			   first.  Otherwise we start with a sector of all zeros. */
-			if (sector_ofs > 0 || chunk_size < sector_left) 
-				disk_read (filesys_disk, sector_idx, bounce);
+			if ((sector_ofs > 0 || chunk_size < sector_left)
+					&& (sector_pos < fresh_start || sector_pos >= fresh_end))
+				data_read (inode, sector_idx, bounce);
 			else
 				memset (bounce, 0, DISK_SECTOR_SIZE);
 			memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-			disk_write (filesys_disk, sector_idx, bounce); 
+			data_write (inode, sector_idx, bounce);
 		}
 
 		/* Advance. */
@@ -282,18 +1424,105 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		offset += chunk_size;
 		bytes_written += chunk_size;
 	}
+	if (shared) {
+		lock_release (&inode->overwrite_lock);
+		rwlock_release_read (&inode->rwlock);
+	} else {
+		if (remapped)
+			inode_flush (inode);
+		rwlock_release_write (&inode->rwlock);
+		journal_end ();
+	}
 	free (bounce);
 
 	return bytes_written;
 }
 
+/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
+ * Returns the number of bytes actually read, which may be less
+ * than SIZE if an error occurs or end of file is reached.
+ *
+ * A user BUFFER is filled a page at a time from a kernel page,
+ * outside INODE's rwlock.  Touching user memory may page fault,
+ * and the fault handler may read a file, INODE itself if BUFFER
+ * is one of its mappings, which would deadlock against a writer
+ * queued on the rwlock. */
+off_t
+inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
+	uint8_t *buffer = buffer_;
+	uint8_t *page;
+	off_t bytes_read = 0;
+
+	if (!is_user_vaddr (buffer))
+		return read_at (inode, buffer, size, offset);
+
+	page = palloc_get_page (0);
+	if (page == NULL)
+		return 0;
+	while (size > 0) {
+		off_t chunk_size = size < PGSIZE ? size : PGSIZE;
+		off_t chunk_read = read_at (inode, page, chunk_size, offset);
+
+		memcpy (buffer + bytes_read, page, chunk_read);
+		size -= chunk_read;
+		offset += chunk_read;
+		bytes_read += chunk_read;
+		if (chunk_read < chunk_size)
+			break;
+	}
+	palloc_free_page (page);
+
+	return bytes_read;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+ * Writing past end of file extends INODE, and any gap between
+ * the old end of file and OFFSET reads back as zeros.
+ * Returns the number of bytes actually written, which may be
+ * less than SIZE if the disk is full or an error occurs.
+ *
+ * A user BUFFER is copied into a kernel page a page at a time
+ * before taking INODE's rwlock, for the reason given above
+ * inode_read_at(). */
+off_t
+inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+		off_t offset) {
+	const uint8_t *buffer = buffer_;
+	uint8_t *page;
+	off_t bytes_written = 0;
+
+	if (!is_user_vaddr (buffer))
+		return write_at (inode, buffer, size, offset);
+
+	page = palloc_get_page (0);
+	if (page == NULL)
+		return 0;
+	while (size > 0) {
+		off_t chunk_size = size < PGSIZE ? size : PGSIZE;
+		off_t chunk_written;
+
+		memcpy (page, buffer + bytes_written, chunk_size);
+		chunk_written = write_at (inode, page, chunk_size, offset);
+		size -= chunk_written;
+		offset += chunk_written;
+		bytes_written += chunk_written;
+		if (chunk_written < chunk_size)
+			break;
+	}
+	palloc_free_page (page);
+
+	return bytes_written;
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 	void
 inode_deny_write (struct inode *inode) 
 {
+	lock_acquire (&inode->lock);
 	inode->deny_write_cnt++;
 	ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+	lock_release (&inode->lock);
 }
 
 /* Re-enables writes to INODE.
@@ -301,9 +1530,11 @@ inode_deny_write (struct inode *inode)
  * inode_deny_write() on the inode, before closing the inode. */
 void
 inode_allow_write (struct inode *inode) {
+	lock_acquire (&inode->lock);
 	ASSERT (inode->deny_write_cnt > 0);
 	ASSERT (inode->deny_write_cnt <= inode->open_cnt);
 	inode->deny_write_cnt--;
+	lock_release (&inode->lock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -311,3 +1542,67 @@ off_t
 inode_length (const struct inode *inode) {
 	return inode->data.length;
 }
+
+/* Returns the offset of the first byte at or after OFFSET in
+ * INODE that lies in a hole if HOLE is true, or outside of one if
+ * HOLE is false.  Returns INODE's length if there is no such
+ * byte.  Holes are whole sectors, so unless OFFSET itself
+ * qualifies, the result is sector aligned.  Holes and data
+ * alternate run by run, so this looks at two runs at most. */
+static off_t
+seek_hole (struct inode *inode, off_t offset, bool hole) {
+	off_t length;
+
+	rwlock_acquire_read (&inode->rwlock);
+	length = inode_length (inode);
+	while (offset < length) {
+		size_t sector_pos = offset / DISK_SECTOR_SIZE;
+		size_t end;
+		bool in_hole;
+
+		if (sector_pos >= inode->sector_cnt) {
+			/* Inline or delayed data, past the block map. */
+			if (hole)
+				offset = length;
+			break;
+		}
+		end = run_end (inode, sector_pos, &in_hole);
+		if (in_hole == hole)
+			break;
+		offset = end * DISK_SECTOR_SIZE;
+	}
+	rwlock_release_read (&inode->rwlock);
+	return offset < length ? offset : length;
+}
+
+/* Returns the offset of the first byte at or after OFFSET in
+ * INODE that is backed by data rather than a hole, or INODE's
+ * length if there is none. */
+off_t
+inode_seek_data (struct inode *inode, off_t offset) {
+	return seek_hole (inode, offset, false);
+}
+
+/* Returns the offset of the first byte at or after OFFSET in
+ * INODE that lies in a hole, or INODE's length if there is
+ * none. */
+off_t
+inode_seek_hole (struct inode *inode, off_t offset) {
+	return seek_hole (inode, offset, true);
+}
+
+/* Returns a hash value for inode E. */
+static uint64_t
+inode_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct inode *inode = hash_entry (e, struct inode, elem);
+	return hash_int (inode->sector);
+}
+
+/* Returns true if inode A precedes inode B. */
+static bool
+inode_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct inode *a = hash_entry (a_, struct inode, elem);
+	const struct inode *b = hash_entry (b_, struct inode, elem);
+	return a->sector < b->sector;
+}
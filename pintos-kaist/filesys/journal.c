@@ -0,0 +1,443 @@
+/* journal.c: Write-ahead journal for file system metadata.
+ *
+ * Inodes, indirect extent blocks, directory blocks, the free map
+ * and the FAT are written through journal_write().  Writes are
+ * gathered in memory into a single running transaction; a sector
+ * written twice is kept once, in its latest version.  Committing
+ * a transaction writes all of its sectors to the log, one after
+ * another, then writes the log header that lists their home
+ * sectors, which is the commit point.  Only then are the sectors
+ * written home, after which the header is cleared.
+ *
+ * Each file system operation is bracketed by journal_begin() and
+ * journal_end(), and a transaction is committed only when no
+ * operation is in progress, so an operation is never split
+ * between transactions.  To make sure an operation fits, the
+ * outermost journal_begin() reserves JOURNAL_OP_MAX sectors of
+ * the log for it, counting the free map or FAT sectors it
+ * changes, and waits for a commit if the running transaction
+ * cannot spare them.  Commits are grouped: one happens once
+ * JOURNAL_COMMIT_CNT sectors have built up, or once the oldest
+ * of them has waited JOURNAL_COMMIT_TICKS, and at shutdown.
+ * Under steady load there may never be a moment with no
+ * operation in progress, so a committer thread checks the age of
+ * the running transaction every JOURNAL_CHECK_TICKS and, once it
+ * is due, holds new operations back until the ones in progress
+ * have ended and the transaction has been committed.
+ *
+ * After a crash, journal_open() writes home the sectors of a
+ * transaction that committed but may not have reached home,
+ * which takes at most JOURNAL_MAX sector copies.  The -jcrash
+ * option makes shutdown stop right after committing the last
+ * transaction, so that tests can check that replay works. */
+
+#include "filesys/journal.h"
+#include <debug.h>
+#include <stdint.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#ifdef EFILESYS
+#include "filesys/fat.h"
+#else
+#include "filesys/free-map.h"
+#endif
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Identifies a journal header. */
+#define JOURNAL_MAGIC 0x4c4e524a
+
+/* Most log sectors one file system operation may fill, counting
+ * the free map or FAT sectors it changes.  Creating a file in a
+ * hashed directory whose bucket splits repeatedly comes closest. */
+#define JOURNAL_OP_MAX 32
+
+/* Group commit thresholds. */
+#define JOURNAL_COMMIT_CNT (JOURNAL_MAX / 2)
+#define JOURNAL_COMMIT_TICKS (5 * TIMER_FREQ)
+
+/* How often the committer thread wakes up. */
+#define JOURNAL_CHECK_TICKS TIMER_FREQ
+
+/* On-disk journal header.
+ * Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct journal_header {
+	uint32_t magic;                     /* JOURNAL_MAGIC. */
+	uint32_t cnt;                       /* Committed sectors, 0 if none. */
+	disk_sector_t sectors[JOURNAL_MAX]; /* Home of each logged sector. */
+};
+
+/* The running transaction. */
+static disk_sector_t *homes;           /* Home sector of each entry. */
+static uint8_t *blocks;                /* Contents of each entry. */
+static size_t block_cnt;               /* Number of entries. */
+static int64_t first_write;            /* When the first entry came in. */
+
+static bool enabled;                   /* Journal open? */
+static int active_cnt;                 /* Outermost operations in progress. */
+static struct thread *committer;       /* Thread committing, if any. */
+static bool commit_wanted;             /* Hold new operations back? */
+static struct lock journal_lock;       /* Protects all of the above. */
+static struct condition commit_done;   /* Signaled when a commit ends. */
+static bool skip_home;                 /* Commit to the log only? */
+
+/* If true, the transaction committed by journal_close() is not
+ * written home.  Set by the -jcrash option. */
+bool journal_crash;
+
+/* Returns the contents of entry IDX of the running transaction. */
+static uint8_t *
+block_at (size_t idx) {
+	return blocks + idx * DISK_SECTOR_SIZE;
+}
+
+/* Returns the index of SECTOR's entry in the running transaction,
+ * or -1 if it has none.  Must be called with journal_lock held. */
+static int
+find_block (disk_sector_t sector) {
+	size_t i;
+
+	for (i = 0; i < block_cnt; i++)
+		if (homes[i] == sector)
+			return i;
+	return -1;
+}
+
+/* Writes HEADER to the journal's header sector. */
+static void
+write_header (const struct journal_header *header) {
+	disk_write (filesys_disk, JOURNAL_SECTOR, header);
+}
+
+/* Writes the running transaction to the log, commits it, writes
+ * its sectors home, and empties it.  Must be called with
+ * journal_lock held. */
+static void
+write_transaction (void) {
+	static struct journal_header header;
+	enum disk_origin old_origin;
+	size_t i;
+
+	if (block_cnt == 0)
+		return;
+
+	old_origin = disk_set_origin (DISK_META);
+	disk_write_multi (filesys_disk, JOURNAL_SECTOR + 1, blocks, block_cnt);
+	header.magic = JOURNAL_MAGIC;
+	header.cnt = block_cnt;
+	memcpy (header.sectors, homes, block_cnt * sizeof *homes);
+	write_header (&header);
+
+	if (!skip_home) {
+		for (i = 0; i < block_cnt; i++)
+			disk_write (filesys_disk, homes[i], block_at (i));
+		header.cnt = 0;
+		write_header (&header);
+	}
+	disk_set_origin (old_origin);
+
+	block_cnt = 0;
+}
+
+/* Commits the running transaction.  The metadata that is kept in
+ * memory and written lazily, the free map or the FAT, joins it
+ * first.  The caller must have set itself as COMMITTER. */
+static void
+commit (void) {
+	ASSERT (committer == thread_current ());
+
+	/* The flush writes through inodes, whose journal_begin() calls
+	 * must nest rather than wait for this very commit. */
+	thread_current ()->journal_depth++;
+#ifdef EFILESYS
+	fat_flush ();
+#else
+	free_map_flush ();
+#endif
+	thread_current ()->journal_depth--;
+
+	lock_acquire (&journal_lock);
+	write_transaction ();
+	committer = NULL;
+	commit_wanted = false;
+	cond_broadcast (&commit_done, &journal_lock);
+	lock_release (&journal_lock);
+}
+
+/* Returns the number of sectors of the running transaction,
+ * counting the free map or FAT sectors that will join it when it
+ * is committed.  Must be called with journal_lock held. */
+static size_t
+pending_cnt (void) {
+#ifdef EFILESYS
+	return block_cnt + fat_dirty_cnt ();
+#else
+	return block_cnt + free_map_dirty_cnt ();
+#endif
+}
+
+/* Returns true if the running transaction has room for one more
+ * operation besides those in progress.  Must be called with
+ * journal_lock held. */
+static bool
+has_room (void) {
+	return pending_cnt () + (active_cnt + 1) * JOURNAL_OP_MAX <= JOURNAL_MAX;
+}
+
+/* Returns true if the running transaction should be committed
+ * now that no operation is in progress.  Must be called with
+ * journal_lock held. */
+static bool
+commit_due (void) {
+	size_t cnt = pending_cnt ();
+
+	return cnt >= JOURNAL_COMMIT_CNT || !has_room ()
+		|| (cnt > 0 && timer_elapsed (first_write) >= JOURNAL_COMMIT_TICKS);
+}
+
+/* Committer thread.  Commits the running transaction once it is
+ * due, first holding new operations back until the operations in
+ * progress have ended if there are any; the last of them then
+ * commits in journal_end(). */
+static void
+committer_thread (void *aux UNUSED) {
+	for (;;) {
+		bool due = false;
+
+		timer_sleep (JOURNAL_CHECK_TICKS);
+
+		lock_acquire (&journal_lock);
+		if (!enabled) {
+			lock_release (&journal_lock);
+			return;
+		}
+		if (committer == NULL && commit_due ()) {
+			if (active_cnt == 0) {
+				committer = thread_current ();
+				due = true;
+			} else
+				commit_wanted = true;
+		}
+		lock_release (&journal_lock);
+
+		if (due)
+			commit ();
+	}
+}
+
+/* Writes an empty journal to disk. */
+void
+journal_format (void) {
+	static struct journal_header header;
+
+	ASSERT (sizeof header == DISK_SECTOR_SIZE);
+	header.magic = JOURNAL_MAGIC;
+	header.cnt = 0;
+	write_header (&header);
+}
+
+/* Opens the journal, first writing home any transaction that
+ * committed before a crash, and starts journaling metadata
+ * writes.  Until this is called they go straight to disk. */
+void
+journal_open (void) {
+	struct journal_header *header;
+	size_t i;
+
+	homes = malloc (JOURNAL_MAX * sizeof *homes);
+	blocks = malloc (JOURNAL_MAX * DISK_SECTOR_SIZE);
+	header = malloc (sizeof *header);
+	if (homes == NULL || blocks == NULL || header == NULL)
+		PANIC ("can't allocate journal");
+
+	/* Replay. */
+	disk_read (filesys_disk, JOURNAL_SECTOR, header);
+	if (header->magic == JOURNAL_MAGIC && header->cnt > 0) {
+		ASSERT (header->cnt <= JOURNAL_MAX);
+		disk_read_multi (filesys_disk, JOURNAL_SECTOR + 1, blocks, header->cnt);
+		for (i = 0; i < header->cnt; i++)
+			disk_write (filesys_disk, header->sectors[i], block_at (i));
+		header->cnt = 0;
+		write_header (header);
+	}
+	free (header);
+
+	lock_init (&journal_lock);
+	cond_init (&commit_done);
+	block_cnt = 0;
+	active_cnt = 0;
+	committer = NULL;
+	commit_wanted = false;
+	enabled = true;
+
+	if (thread_create ("journal", PRI_DEFAULT, committer_thread, NULL)
+			== TID_ERROR)
+		PANIC ("can't start journal committer");
+}
+
+/* Commits what is left and stops journaling, so that later
+ * metadata writes go straight to disk.  With -jcrash, what is
+ * left is committed to the log but not written home, as if the
+ * machine had stopped at the commit point; the next
+ * journal_open() must replay it. */
+void
+journal_close (void) {
+	if (!enabled)
+		return;
+	skip_home = journal_crash;
+	journal_sync ();
+	lock_acquire (&journal_lock);
+	enabled = false;
+	lock_release (&journal_lock);
+	free (homes);
+	free (blocks);
+}
+
+/* Commits the running transaction now, holding new operations
+ * back and waiting for those in progress to finish first. */
+void
+journal_sync (void) {
+	if (!enabled)
+		return;
+
+	lock_acquire (&journal_lock);
+	while (committer != NULL || active_cnt > 0) {
+		commit_wanted = true;
+		cond_wait (&commit_done, &journal_lock);
+	}
+	committer = thread_current ();
+	lock_release (&journal_lock);
+
+	commit ();
+}
+
+/* Begins a file system operation.  Its metadata writes go into
+ * the same transaction.  Waits while a transaction is being
+ * committed or the committer thread holds operations back, and
+ * until the running transaction has room for
+ * JOURNAL_OP_MAX more sectors, committing it first if no other
+ * operation is in progress.  Operations may nest; only the
+ * outermost one waits. */
+void
+journal_begin (void) {
+	struct thread *cur = thread_current ();
+
+	if (!enabled || cur->journal_depth++ > 0)
+		return;
+
+	lock_acquire (&journal_lock);
+	while (committer != NULL || commit_wanted || !has_room ()) {
+		if (committer == NULL && active_cnt == 0) {
+			committer = cur;
+			lock_release (&journal_lock);
+			commit ();
+			lock_acquire (&journal_lock);
+		} else
+			cond_wait (&commit_done, &journal_lock);
+	}
+	active_cnt++;
+	lock_release (&journal_lock);
+}
+
+/* Ends a file system operation begun with journal_begin(),
+ * committing the running transaction if it is due and no other
+ * operation is in progress. */
+void
+journal_end (void) {
+	bool due = false;
+
+	if (!enabled)
+		return;
+	ASSERT (thread_current ()->journal_depth > 0);
+	if (--thread_current ()->journal_depth > 0)
+		return;
+
+	lock_acquire (&journal_lock);
+	ASSERT (active_cnt > 0);
+	if (--active_cnt == 0) {
+		if (committer == NULL && (commit_wanted || commit_due ())) {
+			committer = thread_current ();
+			due = true;
+		} else
+			cond_broadcast (&commit_done, &journal_lock);
+	}
+	lock_release (&journal_lock);
+
+	if (due)
+		commit ();
+}
+
+/* Reads metadata SECTOR into BUFFER, from the running transaction
+ * if it has a newer version than the disk. */
+void
+journal_read (disk_sector_t sector, void *buffer) {
+	enum disk_origin old_origin;
+	int idx;
+
+	if (enabled) {
+		lock_acquire (&journal_lock);
+		idx = find_block (sector);
+		if (idx >= 0) {
+			memcpy (buffer, block_at (idx), DISK_SECTOR_SIZE);
+			lock_release (&journal_lock);
+			return;
+		}
+		lock_release (&journal_lock);
+	}
+	old_origin = disk_set_origin (DISK_META);
+	disk_read (filesys_disk, sector, buffer);
+	disk_set_origin (old_origin);
+}
+
+/* Writes BUFFER to metadata SECTOR as part of the running
+ * transaction.  The reservations taken by journal_begin() make
+ * sure the transaction has room for it. */
+void
+journal_write (disk_sector_t sector, const void *buffer) {
+	int idx;
+
+	if (!enabled) {
+		enum disk_origin old_origin = disk_set_origin (DISK_META);
+		disk_write (filesys_disk, sector, buffer);
+		disk_set_origin (old_origin);
+		return;
+	}
+
+	lock_acquire (&journal_lock);
+	idx = find_block (sector);
+	if (idx < 0) {
+		if (block_cnt == JOURNAL_MAX)
+			PANIC ("journal full: operation exceeded its reservation");
+		if (block_cnt == 0)
+			first_write = timer_ticks ();
+		idx = block_cnt++;
+		homes[idx] = sector;
+	}
+	memcpy (block_at (idx), buffer, DISK_SECTOR_SIZE);
+	lock_release (&journal_lock);
+}
+
+/* Drops the CNT sectors starting at SECTOR from the running
+ * transaction.  Called when they are freed, so that a stale
+ * metadata write cannot land on them after they have been
+ * reused for file data, which does not go through the journal. */
+void
+journal_revoke (disk_sector_t sector, size_t cnt) {
+	size_t i;
+
+	if (!enabled)
+		return;
+
+	lock_acquire (&journal_lock);
+	for (i = 0; i < block_cnt; ) {
+		if (homes[i] >= sector && homes[i] - sector < cnt) {
+			block_cnt--;
+			homes[i] = homes[block_cnt];
+			memcpy (block_at (i), block_at (block_cnt), DISK_SECTOR_SIZE);
+		} else
+			i++;
+	}
+	lock_release (&journal_lock);
+}
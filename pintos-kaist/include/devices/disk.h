@@ -2,7 +2,11 @@
 #define DEVICES_DISK_H
 
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <disk-stats.h>
+#include <list.h>
+#include "threads/synch.h"
 
 /* Size of a disk sector in bytes. */
 #define DISK_SECTOR_SIZE 512
@@ -15,13 +19,54 @@ typedef uint32_t disk_sector_t;
  * printf ("sector=%"PRDSNu"\n", sector); */
 #define PRDSNu PRIu32
 
+/* Most sectors in a single disk request. */
+#define DISK_TRANSFER_MAX 256
+
+struct disk_request;
+
+/* Called when a disk request completes, from the disk interrupt
+ * handler. */
+typedef void disk_request_func (struct disk_request *, void *aux);
+
+/* An asynchronous transfer of one or more consecutive sectors.
+ * Set up with disk_request_init(), then pass to disk_submit(). */
+struct disk_request {
+	struct list_elem elem;      /* Element in channel's queue. */
+	struct disk *disk;          /* Disk, set by disk_submit(). */
+	disk_sector_t sec_no;       /* First sector. */
+	void *buffer;               /* CNT sectors of kernel memory. */
+	size_t cnt;                 /* Number of sectors. */
+	bool write;                 /* Write to the disk, or read? */
+	disk_request_func *func;    /* Completion callback, or NULL. */
+	void *aux;                  /* Passed to FUNC. */
+	size_t done_cnt;            /* Sectors transferred so far. */
+	bool error;                 /* Failed?  Set on completion. */
+	int64_t deadline;           /* Tick by which to schedule it. */
+	enum disk_origin origin;    /* Charged in statistics. */
+	uint64_t start_tsc;         /* TSC at submission. */
+	struct semaphore done;      /* Up'd on completion. */
+};
+
+/* Use PIO rather than bus master DMA for all disks? */
+extern bool disk_pio_only;
+
 void disk_init (void);
 void disk_print_stats (void);
+bool disk_get_stats (int chan_no, int dev_no, struct disk_stats *);
+enum disk_origin disk_set_origin (enum disk_origin);
 
 struct disk *disk_get (int chan_no, int dev_no);
 disk_sector_t disk_size (struct disk *);
 void disk_read (struct disk *, disk_sector_t, void *);
 void disk_write (struct disk *, disk_sector_t, const void *);
+void disk_read_multi (struct disk *, disk_sector_t, void *, size_t cnt);
+void disk_write_multi (struct disk *, disk_sector_t, const void *,
+		size_t cnt);
+
+void disk_request_init (struct disk_request *, disk_sector_t, void *buffer,
+		size_t cnt, bool write, disk_request_func *, void *aux);
+void disk_submit (struct disk *, struct disk_request *);
+bool disk_wait (struct disk_request *);
 
 void 	register_disk_inspect_intr ();
 #endif /* devices/disk.h */
@@ -18,6 +18,16 @@ void timer_msleep (int64_t milliseconds);
 void timer_usleep (int64_t microseconds);
 void timer_nsleep (int64_t nanoseconds);
 
+void timer_udelay (int64_t microseconds);
+void timer_ndelay (int64_t nanoseconds);
+
+void timer_idle_enter (void);
+void timer_idle_exit (void);
+
+uint64_t clock_monotonic (void);
+uint64_t clock_cycles_to_ns (uint64_t cycles);
+void *timer_clock_page (void);
+
 void timer_print_stats (void);
 
 #endif /* devices/timer.h */
@@ -0,0 +1,16 @@
+#ifndef FILESYS_DENTRY_H
+#define FILESYS_DENTRY_H
+
+#include <stdbool.h>
+#include "devices/disk.h"
+
+/* Inode sector recorded for a name that is known not to exist. */
+#define DENTRY_NEGATIVE ((disk_sector_t) -1)
+
+void dentry_init (void);
+bool dentry_lookup (disk_sector_t dir_sector, const char *name,
+		disk_sector_t *inode_sectorp);
+void dentry_insert (disk_sector_t dir_sector, const char *name,
+		disk_sector_t inode_sector);
+
+#endif /* filesys/dentry.h */
@@ -23,6 +23,8 @@ void fat_open (void);
 void fat_close (void);
 void fat_create (void);
 void fat_close (void);
+void fat_flush (void);
+size_t fat_dirty_cnt (void);
 
 cluster_t fat_create_chain (
     cluster_t clst /* Cluster # to stretch, 0: Create a new chain */
@@ -31,8 +33,27 @@ void fat_remove_chain (
     cluster_t clst, /* Cluster # to be removed */
     cluster_t pclst /* Previous cluster of clst, 0: clst is the start of chain */
 );
+bool fat_reserve (size_t cnt);
+void fat_unreserve (size_t cnt);
+cluster_t fat_claim_chain (cluster_t clst);
 cluster_t fat_get (cluster_t clst);
 void fat_put (cluster_t clst, cluster_t val);
 disk_sector_t cluster_to_sector (cluster_t clst);
+cluster_t sector_to_cluster (disk_sector_t sector);
+
+/* Remembers the clusters of one chain by their position in it,
+ * so that finding the Nth cluster of a file does not walk the
+ * chain from its head.  The chain's owner must destroy its cache
+ * when it cuts the chain with fat_remove_chain(); caches of other
+ * chains stay valid. */
+struct fat_chain_cache {
+	cluster_t *map;             /* MAP[i] is the i'th cluster of the chain. */
+	size_t map_cnt;             /* Number of slots allocated in MAP. */
+	size_t known_cnt;           /* MAP[0...KNOWN_CNT) are valid. */
+};
+
+void fat_chain_cache_init (struct fat_chain_cache *);
+void fat_chain_cache_destroy (struct fat_chain_cache *);
+cluster_t fat_chain_seek (struct fat_chain_cache *, cluster_t head, size_t idx);
 
 #endif /* filesys/fat.h */
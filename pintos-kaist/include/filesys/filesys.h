@@ -6,7 +6,14 @@
 
 /* Sectors of system file inodes. */
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
+#ifdef EFILESYS
+#include "filesys/fat.h"
+#define ROOT_DIR_SECTOR cluster_to_sector (ROOT_DIR_CLUSTER)
+#define JOURNAL_SECTOR 1        /* Metadata journal, before the FAT. */
+#else
 #define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
+#define JOURNAL_SECTOR 2        /* Metadata journal, JOURNAL_SECTORS long. */
+#endif
 
 /* Disk used for file system. */
 extern struct disk *filesys_disk;
@@ -0,0 +1,31 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/disk.h"
+
+/* Most metadata sectors one transaction can hold. */
+#define JOURNAL_MAX 126
+
+/* Size of the on-disk journal: a header sector, then one log
+ * sector per sector of a transaction.  It begins at
+ * JOURNAL_SECTOR (see filesys.h). */
+#define JOURNAL_SECTORS (1 + JOURNAL_MAX)
+
+/* Leave the last transaction in the log at shutdown? */
+extern bool journal_crash;
+
+void journal_format (void);
+void journal_open (void);
+void journal_close (void);
+void journal_sync (void);
+
+void journal_begin (void);
+void journal_end (void);
+
+void journal_read (disk_sector_t, void *);
+void journal_write (disk_sector_t, const void *);
+void journal_revoke (disk_sector_t, size_t cnt);
+
+#endif /* filesys/journal.h */
@@ -0,0 +1,37 @@
+#ifndef __LIB_CLOCK_H
+#define __LIB_CLOCK_H
+
+#include <stdint.h>
+
+/* User address of the clock page.  The kernel maps it read-only
+   into every user process, just above the stack, so that user
+   code can turn the time stamp counter into nanoseconds without
+   a system call. */
+#define CLOCK_PAGE ((const struct clock_page *) 0x47490000)
+
+/* Contents of the clock page.  Filled in once the kernel has
+   calibrated the TSC at boot, and never changed afterward. */
+struct clock_page {
+	uint64_t tsc_base;          /* TSC value at boot. */
+	uint64_t tsc_hz;            /* TSC cycles per second. */
+	uint64_t mult;              /* Nanoseconds per cycle, times 2**32. */
+};
+
+/* Returns A * B / 2**32, rounded down, without overflowing 64 bits
+   along the way as long as the result fits. */
+static inline uint64_t
+clock_mul_shift32 (uint64_t a, uint64_t b) {
+	uint64_t ah = a >> 32, al = a & 0xffffffff;
+	uint64_t bh = b >> 32, bl = b & 0xffffffff;
+
+	return ((ah * bh) << 32) + ah * bl + al * bh + ((al * bl) >> 32);
+}
+
+/* Returns the nanoseconds since boot at which the TSC read TSC,
+   according to calibration CP. */
+static inline uint64_t
+clock_page_ns (const struct clock_page *cp, uint64_t tsc) {
+	return clock_mul_shift32 (tsc - cp->tsc_base, cp->mult);
+}
+
+#endif /* lib/clock.h */
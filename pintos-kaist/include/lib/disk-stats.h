@@ -0,0 +1,47 @@
+#ifndef __LIB_DISK_STATS_H
+#define __LIB_DISK_STATS_H
+
+#include <stdint.h>
+
+/* Where a disk request comes from.  Each thread charges its disk
+   requests to the origin it has set with disk_set_origin(). */
+enum disk_origin {
+	DISK_OTHER,                 /* Anything not listed below. */
+	DISK_SWAP,                  /* Swapping anonymous pages. */
+	DISK_DATA,                  /* File contents. */
+	DISK_META,                  /* Inodes, directories, free map, journal. */
+	DISK_FAT,                   /* The file allocation table. */
+	DISK_ORIGIN_CNT
+};
+
+/* Number of latency histogram buckets.  Bucket I counts requests
+   that took from 2**I up to 2**(I+1) TSC cycles, the last bucket
+   everything longer. */
+#define DISK_LATENCY_BUCKETS 40
+
+/* Statistics for reads or for writes on one disk.  A request's
+   latency runs from its submission to its completion, so that it
+   includes time spent waiting in the queue. */
+struct disk_op_stats {
+	uint64_t cnt;               /* Requests completed. */
+	uint64_t sectors;           /* Sectors transferred. */
+	uint64_t sequential;        /* Requests that began where the disk's
+								   previous request ended. */
+	uint64_t cycles;            /* Sum of latencies, in TSC cycles. */
+	uint64_t max_cycles;        /* Longest latency, in TSC cycles. */
+	uint64_t latency[DISK_LATENCY_BUCKETS]; /* Latency histogram. */
+};
+
+/* Statistics for one disk, as returned by the disk_stats system
+   call.  Every member is a uint64_t, so that the inspect
+   interrupt can return any of them by index. */
+struct disk_stats {
+	struct disk_op_stats read;  /* Reads. */
+	struct disk_op_stats write; /* Writes. */
+	uint64_t origin_sectors[DISK_ORIGIN_CNT]; /* Sectors by origin. */
+	uint64_t depth_samples;     /* Requests submitted. */
+	uint64_t depth_sum;         /* Sum of queue depths seen by them. */
+	uint64_t depth_max;         /* Deepest queue seen. */
+};
+
+#endif /* lib/disk-stats.h */
@@ -36,6 +36,20 @@ enum {
 
 	SYS_MOUNT,
 	SYS_UMOUNT,
+
+	/* Scatter/gather and positional I/O. */
+	SYS_READV,                  /* Read a file into several buffers. */
+	SYS_WRITEV,                 /* Write several buffers to a file. */
+	SYS_PREAD,                  /* Read from a file at an offset. */
+	SYS_PWRITE,                 /* Write to a file at an offset. */
+	SYS_PREADV,                 /* readv at an offset. */
+	SYS_PWRITEV,                /* writev at an offset. */
+	SYS_COPY_FILE_RANGE,        /* Copy between files in the kernel. */
+	SYS_GETDENTS,               /* Read many directory entries. */
+
+	/* Diagnostics. */
+	SYS_DISK_STATS,             /* Read a disk's I/O statistics. */
+	SYS_CLOCK_MONOTONIC,        /* Nanoseconds since boot. */
 };
 
 #endif /* lib/syscall-nr.h */
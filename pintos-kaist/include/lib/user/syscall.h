@@ -4,6 +4,9 @@
 #include <stdbool.h>
 #include <debug.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <disk-stats.h>
+#include <clock.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -16,6 +19,28 @@ typedef int off_t;
 /* Maximum characters in a filename written by readdir(). */
 #define READDIR_MAX_LEN 14
 
+/* One buffer of a readv() or writev() request. */
+struct iovec {
+	void *iov_base;             /* Start of the buffer. */
+	size_t iov_len;             /* Size of the buffer in bytes. */
+};
+
+/* Most buffers a single readv() or writev() call accepts: the
+   POSIX minimum, which keeps the kernel's copy of the array small
+   enough for its stack. */
+#define IOV_MAX 16
+
+/* A directory entry, as read by getdents(). */
+struct dirent {
+	int d_ino;                  /* Inode number. */
+	int d_type;                 /* DT_REG or DT_DIR. */
+	char d_name[READDIR_MAX_LEN + 1]; /* Null terminated file name. */
+};
+
+/* Values of d_type. */
+#define DT_REG 1                /* Regular file. */
+#define DT_DIR 2                /* Directory. */
+
 /* Typical return values from main() and arguments to exit(). */
 #define EXIT_SUCCESS 0          /* Successful execution. */
 #define EXIT_FAILURE 1          /* Unsuccessful execution. */
@@ -38,6 +63,18 @@ void close (int fd);
 
 int dup2(int oldfd, int newfd);
 
+int readv (int fd, const struct iovec *iov, int iovcnt);
+int writev (int fd, const struct iovec *iov, int iovcnt);
+int pread (int fd, void *buffer, unsigned length, off_t offset);
+int pwrite (int fd, const void *buffer, unsigned length, off_t offset);
+int preadv (int fd, const struct iovec *iov, int iovcnt, off_t offset);
+int pwritev (int fd, const struct iovec *iov, int iovcnt, off_t offset);
+int copy_file_range (int fd_in, off_t *off_in, int fd_out, off_t *off_out,
+		size_t length);
+int getdents (int fd, struct dirent *buffer, unsigned size);
+int disk_stats (int chan_no, int dev_no, struct disk_stats *stats);
+uint64_t clock_monotonic (void);
+
 /* Project 3 and optionally project 4. */
 void *mmap (void *addr, size_t length, int writable, int fd, off_t offset);
 void munmap (void *addr);
@@ -78,4 +115,26 @@ get_fs_disk_write_cnt (void) {
 	return write_cnt;
 }
 
+/* Returns the nanoseconds since boot, as clock_monotonic() does,
+   but without a system call: reads the time stamp counter and
+   converts it with the calibration in the clock page. */
+static inline uint64_t
+clock_monotonic_fast (void) {
+	uint32_t lo, hi;
+	asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+	return clock_page_ns (CLOCK_PAGE, ((uint64_t) hi << 32) | lo);
+}
+
+/* Returns member IDX, counting uint64_t's, of the struct
+   disk_stats of disk CHAN_NO:DEV_NO. */
+static inline uint64_t
+get_disk_stat (int chan_no, int dev_no, size_t idx) {
+	uint64_t value;
+	asm volatile ("int $0x45"
+			: "=a" (value)
+			: "d" ((uint64_t) chan_no), "c" ((uint64_t) dev_no), "D" (idx)
+			: "memory");
+	return value;
+}
+
 #endif /* lib/user/syscall.h */
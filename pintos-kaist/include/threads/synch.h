@@ -41,6 +41,24 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Readers-writer lock.  Any number of readers may hold it at
+   once, or a single writer.  Waiting writers block new readers
+   so that a steady stream of readers cannot starve them. */
+struct rwlock {
+	struct lock lock;           /* Protects the fields below. */
+	struct condition readers_ok;/* Signaled when readers may enter. */
+	struct condition writer_ok; /* Signaled when a writer may enter. */
+	unsigned readers;           /* Number of readers holding the lock. */
+	unsigned writers_waiting;   /* Number of writers blocked. */
+	struct thread *writer;      /* Writer holding the lock, if any. */
+};
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+
 
 
 void donation_priority(struct thread *t);
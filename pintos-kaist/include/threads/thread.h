@@ -127,6 +127,9 @@ struct thread {
 	int next_FD;					// 다음 사용 가능한 fd값
 	struct file *running_file;		// 현재 프로세스에서 실행 중인 파일
 
+	int disk_origin;                    /* enum disk_origin of disk I/O. */
+	int journal_depth;                  /* Nested journal operations. */
+
 #ifdef USERPROG
 	/* Owned by userprog/process.c. */
 	uint64_t *pml4;                     /* Page map level 4 */
@@ -155,6 +158,7 @@ void thread_print_stats (void);
 
 void thread_sleep(int64_t ticks);
 void thread_wakeup(int64_t global_ticks);
+int64_t thread_next_wakeup(void);
 bool cmp_thread_ticks(const struct list_elem *a, const struct list_elem *b, void *aux);
 bool cmp_priority(const struct list_elem *a, const struct list_elem *b, void *aux UNUSED);
 
@@ -13,6 +13,7 @@ void process_activate (struct thread *next);
 struct thread *get_child_by_tid(tid_t child_tid);
 int process_add_file(struct file *file);
 struct file *process_get_file(int fd);
+bool process_overlaps_clock_page (const void *addr, size_t length);
 
 bool lazy_load_segment(struct page *page, void *aux);
 
@@ -8,6 +8,9 @@ struct anon_page {
     size_t page_no;
 };
 
+/* Swap disk names from the -swap option, or NULL for hd1:1. */
+extern char *swap_disk_names;
+
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
 
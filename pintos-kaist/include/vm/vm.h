@@ -50,6 +50,8 @@ struct page {
 	struct hash_elem hash_elem;
 	bool writable;
 	bool accessible;
+	struct thread *owner;  /* Thread whose page table maps it */
+	bool evicting;         /* Being written out by swap_out()? */
 
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
@@ -54,7 +54,7 @@ static __inline int64_t syscall (uint64_t num_, uint64_t a1_, uint64_t a2_,
 			((uint64_t) ARG2), 0, 0, 0))
 
 #define syscall4(NUMBER, ARG0, ARG1, ARG2, ARG3) ( \
-		syscall(((uint64_t *) NUMBER), \
+		syscall(((uint64_t) NUMBER), \
 			((uint64_t) ARG0), \
 			((uint64_t) ARG1), \
 			((uint64_t) ARG2), \
@@ -194,3 +194,55 @@ int
 umount (const char *path) {
 	return syscall1 (SYS_UMOUNT, path);
 }
+
+int
+readv (int fd, const struct iovec *iov, int iovcnt) {
+	return syscall3 (SYS_READV, fd, iov, iovcnt);
+}
+
+int
+writev (int fd, const struct iovec *iov, int iovcnt) {
+	return syscall3 (SYS_WRITEV, fd, iov, iovcnt);
+}
+
+int
+pread (int fd, void *buffer, unsigned size, off_t offset) {
+	return syscall4 (SYS_PREAD, fd, buffer, size, offset);
+}
+
+int
+pwrite (int fd, const void *buffer, unsigned size, off_t offset) {
+	return syscall4 (SYS_PWRITE, fd, buffer, size, offset);
+}
+
+int
+preadv (int fd, const struct iovec *iov, int iovcnt, off_t offset) {
+	return syscall4 (SYS_PREADV, fd, iov, iovcnt, offset);
+}
+
+int
+pwritev (int fd, const struct iovec *iov, int iovcnt, off_t offset) {
+	return syscall4 (SYS_PWRITEV, fd, iov, iovcnt, offset);
+}
+
+int
+copy_file_range (int fd_in, off_t *off_in, int fd_out, off_t *off_out,
+		size_t length) {
+	return syscall5 (SYS_COPY_FILE_RANGE, fd_in, off_in, fd_out, off_out,
+			length);
+}
+
+int
+getdents (int fd, struct dirent *buffer, unsigned size) {
+	return syscall3 (SYS_GETDENTS, fd, buffer, size);
+}
+
+int
+disk_stats (int chan_no, int dev_no, struct disk_stats *stats) {
+	return syscall3 (SYS_DISK_STATS, chan_no, dev_no, stats);
+}
+
+uint64_t
+clock_monotonic (void) {
+	return syscall0 (SYS_CLOCK_MONOTONIC);
+}
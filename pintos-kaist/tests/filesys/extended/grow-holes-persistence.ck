@@ -0,0 +1,8 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($contents) = ("a" x 100) . ("\0" x 8900) . ("c" x 500)
+  . ("\0" x 10500) . ("b" x 100);
+check_archive ({"testfile" => [$contents]});
+pass;
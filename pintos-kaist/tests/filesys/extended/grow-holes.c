@@ -0,0 +1,49 @@
+/* Writes a short run at the start of a file and another far past
+   its end, leaving a hole between them, then writes into the
+   middle of the hole.  Checks that the rest of the hole reads as
+   zeros and that seeking past the end alone does not grow the
+   file. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define RUN_SIZE 100
+#define MID_OFS 9000
+#define MID_SIZE 500
+#define TAIL_OFS 20000
+#define FILE_SIZE (TAIL_OFS + RUN_SIZE)
+
+static char buf[FILE_SIZE];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  int fd;
+
+  memset (buf, 'a', RUN_SIZE);
+  memset (buf + MID_OFS, 'c', MID_SIZE);
+  memset (buf + TAIL_OFS, 'b', RUN_SIZE);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, RUN_SIZE) == RUN_SIZE, "write head of \"%s\"",
+         file_name);
+  msg ("seek \"%s\"", file_name);
+  seek (fd, TAIL_OFS);
+  CHECK (write (fd, buf + TAIL_OFS, RUN_SIZE) == RUN_SIZE,
+         "write tail of \"%s\"", file_name);
+  msg ("seek \"%s\"", file_name);
+  seek (fd, MID_OFS);
+  CHECK (write (fd, buf + MID_OFS, MID_SIZE) == MID_SIZE,
+         "write middle of \"%s\"", file_name);
+  msg ("seek \"%s\"", file_name);
+  seek (fd, 2 * FILE_SIZE);
+  CHECK (filesize (fd) == FILE_SIZE, "filesize \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  check_file (file_name, buf, sizeof buf);
+}
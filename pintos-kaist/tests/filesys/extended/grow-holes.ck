@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-holes) begin
+(grow-holes) create "testfile"
+(grow-holes) open "testfile"
+(grow-holes) write head of "testfile"
+(grow-holes) seek "testfile"
+(grow-holes) write tail of "testfile"
+(grow-holes) seek "testfile"
+(grow-holes) write middle of "testfile"
+(grow-holes) seek "testfile"
+(grow-holes) filesize "testfile"
+(grow-holes) close "testfile"
+(grow-holes) open "testfile" for verification
+(grow-holes) verified contents of "testfile"
+(grow-holes) close "testfile"
+(grow-holes) end
+EOF
+pass;
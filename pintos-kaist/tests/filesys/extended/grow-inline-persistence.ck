@@ -0,0 +1,9 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my ($testfile) = random_bytes (5000);
+my ($small) = random_bytes (300);
+check_archive ({"testfile" => [$testfile], "small" => [$small]});
+pass;
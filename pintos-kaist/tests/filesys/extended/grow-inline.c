@@ -0,0 +1,51 @@
+/* Grows a file a few bytes at a time past the size that fits in
+   its inode sector, checking its contents at each step, and
+   leaves a second file small enough to stay there. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Largest file kept in the inode sector: 60 direct extents of 8
+   bytes each. */
+#define INLINE_SIZE 480
+
+static char buf[5000];
+static char small[300];
+
+/* Appends bytes OFS up to END of BUF to FD, then checks the
+   whole file. */
+static void
+grow_to (int fd, size_t ofs, size_t end) 
+{
+  CHECK (write (fd, buf + ofs, end - ofs) == (int) (end - ofs),
+         "write \"testfile\" up to %zu bytes", end);
+  check_file ("testfile", buf, end);
+}
+
+void
+test_main (void) 
+{
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+  random_bytes (small, sizeof small);
+
+  CHECK (create ("testfile", 0), "create \"testfile\"");
+  CHECK ((fd = open ("testfile")) > 1, "open \"testfile\"");
+  grow_to (fd, 0, 100);
+  grow_to (fd, 100, INLINE_SIZE);
+  grow_to (fd, INLINE_SIZE, INLINE_SIZE + 1);
+  grow_to (fd, INLINE_SIZE + 1, sizeof buf);
+  msg ("close \"testfile\"");
+  close (fd);
+
+  CHECK (create ("small", 0), "create \"small\"");
+  CHECK ((fd = open ("small")) > 1, "open \"small\"");
+  CHECK (write (fd, small, sizeof small) == sizeof small, "write \"small\"");
+  msg ("close \"small\"");
+  close (fd);
+  check_file ("small", small, sizeof small);
+}
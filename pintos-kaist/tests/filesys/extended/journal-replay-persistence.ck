@@ -0,0 +1,9 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my (%files) = ("big" => [random_bytes (8000)]);
+$files{"file$_"} = [random_bytes (100)] foreach 0...9;
+check_archive (\%files);
+pass;
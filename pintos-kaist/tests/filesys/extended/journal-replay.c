@@ -0,0 +1,53 @@
+/* Creates a large file, ten small ones and one that it removes
+   again.  Run with -jcrash, so that the kernel commits this
+   metadata to the journal at shutdown but never writes it home:
+   the persistence check only passes if the next boot replays
+   the journal. */
+
+#include <random.h>
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 10
+
+static char big[8000];
+static char small[FILE_CNT][100];
+
+/* Creates FILE_NAME holding the SIZE bytes in BUF. */
+static void
+make_file (const char *file_name, const void *buf, size_t size) 
+{
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, size) == (int) size, "write \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
+
+void
+test_main (void) 
+{
+  char file_name[16];
+  int i;
+
+  random_init (0);
+  random_bytes (big, sizeof big);
+  for (i = 0; i < FILE_CNT; i++)
+    random_bytes (small[i], sizeof small[i]);
+
+  make_file ("big", big, sizeof big);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (file_name, sizeof file_name, "file%d", i);
+      make_file (file_name, small[i], sizeof small[i]);
+    }
+  make_file ("doomed", big, 600);
+  CHECK (remove ("doomed"), "remove \"doomed\"");
+
+  check_file ("big", big, sizeof big);
+  check_file ("file9", small[9], sizeof small[9]);
+}
@@ -0,0 +1,64 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(journal-replay) begin
+(journal-replay) create "big"
+(journal-replay) open "big"
+(journal-replay) write "big"
+(journal-replay) close "big"
+(journal-replay) create "file0"
+(journal-replay) open "file0"
+(journal-replay) write "file0"
+(journal-replay) close "file0"
+(journal-replay) create "file1"
+(journal-replay) open "file1"
+(journal-replay) write "file1"
+(journal-replay) close "file1"
+(journal-replay) create "file2"
+(journal-replay) open "file2"
+(journal-replay) write "file2"
+(journal-replay) close "file2"
+(journal-replay) create "file3"
+(journal-replay) open "file3"
+(journal-replay) write "file3"
+(journal-replay) close "file3"
+(journal-replay) create "file4"
+(journal-replay) open "file4"
+(journal-replay) write "file4"
+(journal-replay) close "file4"
+(journal-replay) create "file5"
+(journal-replay) open "file5"
+(journal-replay) write "file5"
+(journal-replay) close "file5"
+(journal-replay) create "file6"
+(journal-replay) open "file6"
+(journal-replay) write "file6"
+(journal-replay) close "file6"
+(journal-replay) create "file7"
+(journal-replay) open "file7"
+(journal-replay) write "file7"
+(journal-replay) close "file7"
+(journal-replay) create "file8"
+(journal-replay) open "file8"
+(journal-replay) write "file8"
+(journal-replay) close "file8"
+(journal-replay) create "file9"
+(journal-replay) open "file9"
+(journal-replay) write "file9"
+(journal-replay) close "file9"
+(journal-replay) create "doomed"
+(journal-replay) open "doomed"
+(journal-replay) write "doomed"
+(journal-replay) close "doomed"
+(journal-replay) remove "doomed"
+(journal-replay) open "big" for verification
+(journal-replay) verified contents of "big"
+(journal-replay) close "big"
+(journal-replay) open "file9" for verification
+(journal-replay) verified contents of "file9"
+(journal-replay) close "file9"
+(journal-replay) end
+EOF
+pass;
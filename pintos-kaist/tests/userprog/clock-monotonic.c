@@ -0,0 +1,50 @@
+/* Reads the clock many times, alternating between
+   clock_monotonic() and clock_monotonic_fast(), and checks that
+   it never goes backward and that it keeps advancing. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define READ_CNT 10000
+#define SPIN_NS 20000000
+
+/* Fails unless NOW is at least PREV. */
+static void
+check_order (const char *name, uint64_t prev, uint64_t now) 
+{
+  if (now < prev)
+    fail ("%s went back from %llu ns to %llu ns", name,
+          (unsigned long long) prev, (unsigned long long) now);
+}
+
+void
+test_main (void) 
+{
+  uint64_t start, prev, now;
+  int i;
+
+  CHECK (CLOCK_PAGE->tsc_hz > 0, "clock page is calibrated");
+  CHECK ((start = clock_monotonic ()) > 0, "clock_monotonic");
+
+  msg ("read the clock %d times", READ_CNT);
+  prev = start;
+  for (i = 0; i < READ_CNT; i++)
+    {
+      now = clock_monotonic_fast ();
+      check_order ("clock_monotonic_fast()", prev, now);
+      prev = now;
+      now = clock_monotonic ();
+      check_order ("clock_monotonic()", prev, now);
+      prev = now;
+    }
+
+  msg ("spin for %d ms", SPIN_NS / 1000000);
+  do
+    {
+      now = clock_monotonic ();
+      check_order ("clock_monotonic()", prev, now);
+      prev = now;
+    }
+  while (now - start < SPIN_NS);
+}
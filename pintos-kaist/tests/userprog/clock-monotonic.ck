@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(clock-monotonic) begin
+(clock-monotonic) clock page is calibrated
+(clock-monotonic) clock_monotonic
+(clock-monotonic) read the clock 10000 times
+(clock-monotonic) spin for 20 ms
+(clock-monotonic) end
+clock-monotonic: exit(0)
+EOF
+pass;
@@ -0,0 +1,34 @@
+/* Passes copy_file_range() the console, a closed file and a
+   negative offset, all of which must fail without copying. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  off_t ofs = -1;
+  int in, out, closed;
+
+  CHECK ((in = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK (create ("copy.txt", 0), "create \"copy.txt\"");
+  CHECK ((out = open ("copy.txt")) > 1, "open \"copy.txt\"");
+  CHECK ((closed = open ("copy.txt")) > 1, "open \"copy.txt\" again");
+  msg ("close \"copy.txt\" again");
+  close (closed);
+
+  CHECK (copy_file_range (STDIN_FILENO, NULL, out, NULL, 10) == -1,
+         "copy from stdin");
+  CHECK (copy_file_range (in, NULL, STDOUT_FILENO, NULL, 10) == -1,
+         "copy to stdout");
+  CHECK (copy_file_range (closed, NULL, out, NULL, 10) == -1,
+         "copy from closed file");
+  CHECK (copy_file_range (in, NULL, closed, NULL, 10) == -1,
+         "copy to closed file");
+  CHECK (copy_file_range (in, &ofs, out, NULL, 10) == -1,
+         "copy from negative offset");
+  CHECK (filesize (out) == 0, "filesize \"copy.txt\"");
+  CHECK (tell (in) == 0, "tell \"sample.txt\"");
+}
@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(copy-range-bad-fd) begin
+(copy-range-bad-fd) open "sample.txt"
+(copy-range-bad-fd) create "copy.txt"
+(copy-range-bad-fd) open "copy.txt"
+(copy-range-bad-fd) open "copy.txt" again
+(copy-range-bad-fd) close "copy.txt" again
+(copy-range-bad-fd) copy from stdin
+(copy-range-bad-fd) copy to stdout
+(copy-range-bad-fd) copy from closed file
+(copy-range-bad-fd) copy to closed file
+(copy-range-bad-fd) copy from negative offset
+(copy-range-bad-fd) filesize "copy.txt"
+(copy-range-bad-fd) tell "sample.txt"
+(copy-range-bad-fd) end
+copy-range-bad-fd: exit(0)
+EOF
+pass;
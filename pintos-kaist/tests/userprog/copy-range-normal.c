@@ -0,0 +1,31 @@
+/* Copies "sample.txt" to a new file with copy_file_range(),
+   asking for more than there is, and checks that both file
+   positions moved past the bytes copied. */
+
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  int in, out, byte_cnt;
+
+  CHECK ((in = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK (create ("copy.txt", 0), "create \"copy.txt\"");
+  CHECK ((out = open ("copy.txt")) > 1, "open \"copy.txt\"");
+
+  byte_cnt = copy_file_range (in, NULL, out, NULL, 4096);
+  if (byte_cnt != sizeof sample - 1)
+    fail ("copy_file_range() returned %d instead of %zu",
+          byte_cnt, sizeof sample - 1);
+  CHECK (tell (in) == sizeof sample - 1, "tell \"sample.txt\"");
+  CHECK (tell (out) == sizeof sample - 1, "tell \"copy.txt\"");
+  CHECK (copy_file_range (in, NULL, out, NULL, 4096) == 0,
+         "copy_file_range at end of file");
+  msg ("close \"copy.txt\"");
+  close (out);
+
+  check_file ("copy.txt", sample, sizeof sample - 1);
+}
@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(copy-range-normal) begin
+(copy-range-normal) open "sample.txt"
+(copy-range-normal) create "copy.txt"
+(copy-range-normal) open "copy.txt"
+(copy-range-normal) tell "sample.txt"
+(copy-range-normal) tell "copy.txt"
+(copy-range-normal) copy_file_range at end of file
+(copy-range-normal) close "copy.txt"
+(copy-range-normal) open "copy.txt" for verification
+(copy-range-normal) verified contents of "copy.txt"
+(copy-range-normal) close "copy.txt"
+(copy-range-normal) end
+copy-range-normal: exit(0)
+EOF
+pass;
@@ -0,0 +1,40 @@
+/* Copies part of "sample.txt" into the middle of a new file with
+   copy_file_range(), passing both offsets explicitly, and checks
+   that the offsets were advanced but the file positions were
+   not. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define IN_OFS 50
+#define OUT_OFS 10
+#define COPY_SIZE 100
+
+static char buf[OUT_OFS + COPY_SIZE];
+
+void
+test_main (void) 
+{
+  off_t in_ofs = IN_OFS, out_ofs = OUT_OFS;
+  int in, out, byte_cnt;
+
+  CHECK ((in = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK (create ("copy.txt", 0), "create \"copy.txt\"");
+  CHECK ((out = open ("copy.txt")) > 1, "open \"copy.txt\"");
+
+  byte_cnt = copy_file_range (in, &in_ofs, out, &out_ofs, COPY_SIZE);
+  if (byte_cnt != COPY_SIZE)
+    fail ("copy_file_range() returned %d instead of %d", byte_cnt, COPY_SIZE);
+  CHECK (in_ofs == IN_OFS + COPY_SIZE, "input offset advanced");
+  CHECK (out_ofs == OUT_OFS + COPY_SIZE, "output offset advanced");
+  CHECK (tell (in) == 0, "tell \"sample.txt\"");
+  CHECK (tell (out) == 0, "tell \"copy.txt\"");
+  msg ("close \"copy.txt\"");
+  close (out);
+
+  memcpy (buf + OUT_OFS, sample + IN_OFS, COPY_SIZE);
+  check_file ("copy.txt", buf, sizeof buf);
+}
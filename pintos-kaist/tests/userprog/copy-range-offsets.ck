@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(copy-range-offsets) begin
+(copy-range-offsets) open "sample.txt"
+(copy-range-offsets) create "copy.txt"
+(copy-range-offsets) open "copy.txt"
+(copy-range-offsets) input offset advanced
+(copy-range-offsets) output offset advanced
+(copy-range-offsets) tell "sample.txt"
+(copy-range-offsets) tell "copy.txt"
+(copy-range-offsets) close "copy.txt"
+(copy-range-offsets) open "copy.txt" for verification
+(copy-range-offsets) verified contents of "copy.txt"
+(copy-range-offsets) close "copy.txt"
+(copy-range-offsets) end
+copy-range-offsets: exit(0)
+EOF
+pass;
@@ -0,0 +1,44 @@
+/* Copies a file made of two short runs of data around a long
+   hole with copy_file_range(), and checks that the copy reads
+   back as zeros across the hole and has the same length. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define HEAD_SIZE 700
+#define TAIL_OFS 41000
+#define FILE_SIZE (TAIL_OFS + 900)
+
+static char buf[FILE_SIZE];
+
+void
+test_main (void) 
+{
+  int in, out, byte_cnt;
+
+  random_init (0);
+  random_bytes (buf, HEAD_SIZE);
+  random_bytes (buf + TAIL_OFS, FILE_SIZE - TAIL_OFS);
+
+  CHECK (create ("sparse", 0), "create \"sparse\"");
+  CHECK ((in = open ("sparse")) > 1, "open \"sparse\"");
+  CHECK (write (in, buf, HEAD_SIZE) == HEAD_SIZE, "write head of \"sparse\"");
+  msg ("seek \"sparse\"");
+  seek (in, TAIL_OFS);
+  CHECK (write (in, buf + TAIL_OFS, FILE_SIZE - TAIL_OFS)
+         == FILE_SIZE - TAIL_OFS, "write tail of \"sparse\"");
+  msg ("seek \"sparse\"");
+  seek (in, 0);
+
+  CHECK (create ("copy", 0), "create \"copy\"");
+  CHECK ((out = open ("copy")) > 1, "open \"copy\"");
+  byte_cnt = copy_file_range (in, NULL, out, NULL, 2 * FILE_SIZE);
+  if (byte_cnt != FILE_SIZE)
+    fail ("copy_file_range() returned %d instead of %d", byte_cnt, FILE_SIZE);
+  msg ("close \"copy\"");
+  close (out);
+
+  check_file ("copy", buf, FILE_SIZE);
+}
@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(copy-range-sparse) begin
+(copy-range-sparse) create "sparse"
+(copy-range-sparse) open "sparse"
+(copy-range-sparse) write head of "sparse"
+(copy-range-sparse) seek "sparse"
+(copy-range-sparse) write tail of "sparse"
+(copy-range-sparse) seek "sparse"
+(copy-range-sparse) create "copy"
+(copy-range-sparse) open "copy"
+(copy-range-sparse) close "copy"
+(copy-range-sparse) open "copy" for verification
+(copy-range-sparse) verified contents of "copy"
+(copy-range-sparse) close "copy"
+(copy-range-sparse) end
+copy-range-sparse: exit(0)
+EOF
+pass;
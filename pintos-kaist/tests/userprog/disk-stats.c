@@ -0,0 +1,58 @@
+/* Reads the statistics of the file system disk with disk_stats()
+   and checks that they add up: every completed request lands in
+   one latency bucket, every sector is charged to one origin, and
+   no more requests have completed than were submitted.  Also
+   checks that disk_stats() fails for disks that do not exist. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static struct disk_stats stats;
+
+/* Checks the counters in OP, named NAME, against each other. */
+static void
+check_op (const char *name, const struct disk_op_stats *op) 
+{
+  uint64_t bucket_sum = 0;
+  int i;
+
+  for (i = 0; i < DISK_LATENCY_BUCKETS; i++)
+    bucket_sum += op->latency[i];
+  if (bucket_sum != op->cnt)
+    fail ("%s: %llu requests in latency buckets, %llu completed", name,
+          (unsigned long long) bucket_sum, (unsigned long long) op->cnt);
+  if (op->sectors < op->cnt)
+    fail ("%s: %llu sectors in %llu requests", name,
+          (unsigned long long) op->sectors, (unsigned long long) op->cnt);
+  if (op->max_cycles > op->cycles)
+    fail ("%s: longest request took longer than all of them", name);
+}
+
+void
+test_main (void) 
+{
+  uint64_t origin_sum = 0;
+  int i;
+
+  CHECK (disk_stats (0, 1, &stats) == 0, "disk_stats hd0:1");
+  check_op ("reads", &stats.read);
+  check_op ("writes", &stats.write);
+
+  for (i = 0; i < DISK_ORIGIN_CNT; i++)
+    origin_sum += stats.origin_sectors[i];
+  if (origin_sum != stats.read.sectors + stats.write.sectors)
+    fail ("%llu sectors charged to origins, %llu transferred",
+          (unsigned long long) origin_sum,
+          (unsigned long long) (stats.read.sectors + stats.write.sectors));
+
+  CHECK (stats.read.cnt > 0, "the disk has been read");
+  CHECK (stats.depth_samples >= stats.read.cnt + stats.write.cnt,
+         "no more requests completed than submitted");
+  CHECK (stats.depth_max >= 1, "queue depth reached at least 1");
+  CHECK (get_disk_stat (0, 1, 0) >= stats.read.cnt,
+         "read count never goes down");
+
+  CHECK (disk_stats (0, 2, &stats) == -1, "disk_stats hd0:2");
+  CHECK (disk_stats (4, 0, &stats) == -1, "disk_stats hd4:0");
+}
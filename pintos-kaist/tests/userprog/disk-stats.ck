@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(disk-stats) begin
+(disk-stats) disk_stats hd0:1
+(disk-stats) the disk has been read
+(disk-stats) no more requests completed than submitted
+(disk-stats) queue depth reached at least 1
+(disk-stats) read count never goes down
+(disk-stats) disk_stats hd0:2
+(disk-stats) disk_stats hd4:0
+(disk-stats) end
+disk-stats: exit(0)
+EOF
+pass;
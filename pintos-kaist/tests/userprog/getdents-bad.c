@@ -0,0 +1,30 @@
+/* Checks that getdents() fails on a regular file and with a
+   buffer too small for one entry, and that the root directory,
+   opened as a file, cannot be written. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  struct dirent ent;
+  struct iovec iov;
+  int file, dir;
+
+  CHECK ((file = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK (getdents (file, &ent, sizeof ent) == -1, "getdents on a file");
+
+  CHECK ((dir = open ("/")) > 1, "open \"/\"");
+  CHECK (getdents (dir, &ent, sizeof ent - 1) == -1,
+         "getdents with a short buffer");
+  CHECK (write (dir, "x", 1) == -1, "write \"/\"");
+  iov.iov_base = "x";
+  iov.iov_len = 1;
+  CHECK (writev (dir, &iov, 1) == -1, "writev \"/\"");
+  CHECK (pwrite (dir, "x", 1, 0) == -1, "pwrite \"/\"");
+  CHECK (copy_file_range (file, NULL, dir, NULL, 1) == -1,
+         "copy_file_range to \"/\"");
+  CHECK (getdents (dir, &ent, sizeof ent) == 1, "getdents \"/\"");
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(getdents-bad) begin
+(getdents-bad) open "sample.txt"
+(getdents-bad) getdents on a file
+(getdents-bad) open "/"
+(getdents-bad) getdents with a short buffer
+(getdents-bad) write "/"
+(getdents-bad) writev "/"
+(getdents-bad) pwrite "/"
+(getdents-bad) copy_file_range to "/"
+(getdents-bad) getdents "/"
+(getdents-bad) end
+getdents-bad: exit(0)
+EOF
+pass;
@@ -0,0 +1,63 @@
+/* Creates three files, lists the root directory with getdents()
+   two entries at a time, and checks that each file shows up once
+   as a regular file.  Then removes one of them and checks that a
+   fresh listing leaves it out. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static const char *names[] = {"alpha", "beta", "gamma"};
+#define NAME_CNT (sizeof names / sizeof *names)
+
+/* Lists the root directory and returns how many times each of
+   NAMES appears in it in SEEN. */
+static void
+list_root (int seen[NAME_CNT]) 
+{
+  struct dirent ents[2];
+  int fd, cnt, i;
+  size_t j;
+
+  memset (seen, 0, NAME_CNT * sizeof *seen);
+  CHECK ((fd = open ("/")) > 1, "open \"/\"");
+  while ((cnt = getdents (fd, ents, sizeof ents)) > 0)
+    {
+      if (cnt > 2)
+        fail ("getdents() returned %d entries for a buffer of 2", cnt);
+      for (i = 0; i < cnt; i++)
+        for (j = 0; j < NAME_CNT; j++)
+          if (!strcmp (ents[i].d_name, names[j]))
+            {
+              if (ents[i].d_type != DT_REG)
+                fail ("\"%s\" has type %d", names[j], ents[i].d_type);
+              seen[j]++;
+            }
+    }
+  if (cnt < 0)
+    fail ("getdents() returned %d", cnt);
+  msg ("close \"/\"");
+  close (fd);
+}
+
+void
+test_main (void) 
+{
+  int seen[NAME_CNT];
+  size_t i;
+
+  for (i = 0; i < NAME_CNT; i++)
+    CHECK (create (names[i], 0), "create \"%s\"", names[i]);
+
+  list_root (seen);
+  for (i = 0; i < NAME_CNT; i++)
+    if (seen[i] != 1)
+      fail ("\"%s\" listed %d times", names[i], seen[i]);
+
+  CHECK (remove ("beta"), "remove \"beta\"");
+  list_root (seen);
+  if (seen[0] != 1 || seen[1] != 0 || seen[2] != 1)
+    fail ("listed %d, %d, %d times after removing \"beta\"",
+          seen[0], seen[1], seen[2]);
+}
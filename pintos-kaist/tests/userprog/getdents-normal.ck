@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(getdents-normal) begin
+(getdents-normal) create "alpha"
+(getdents-normal) create "beta"
+(getdents-normal) create "gamma"
+(getdents-normal) open "/"
+(getdents-normal) close "/"
+(getdents-normal) remove "beta"
+(getdents-normal) open "/"
+(getdents-normal) close "/"
+(getdents-normal) end
+getdents-normal: exit(0)
+EOF
+pass;
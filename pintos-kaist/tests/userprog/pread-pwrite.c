@@ -0,0 +1,46 @@
+/* Writes the two halves of "sample.txt"'s contents to a new file
+   with pwrite(), second half first, reads a range from the
+   middle back with pread(), and checks that neither moved the
+   file position. */
+
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define HALF ((sizeof sample - 1) / 2)
+
+static char buf[100];
+
+void
+test_main (void) 
+{
+  int handle, byte_cnt;
+
+  CHECK (create ("test.txt", 0), "create \"test.txt\"");
+  CHECK ((handle = open ("test.txt")) > 1, "open \"test.txt\"");
+
+  byte_cnt = pwrite (handle, sample + HALF, sizeof sample - 1 - HALF, HALF);
+  if (byte_cnt != sizeof sample - 1 - HALF)
+    fail ("pwrite() returned %d instead of %zu",
+          byte_cnt, sizeof sample - 1 - HALF);
+  byte_cnt = pwrite (handle, sample, HALF, 0);
+  if (byte_cnt != HALF)
+    fail ("pwrite() returned %d instead of %zu", byte_cnt, HALF);
+  CHECK (tell (handle) == 0, "tell \"test.txt\" after pwrite");
+
+  byte_cnt = pread (handle, buf, sizeof buf, HALF - 50);
+  if (byte_cnt != sizeof buf)
+    fail ("pread() returned %d instead of %zu", byte_cnt, sizeof buf);
+  compare_bytes (buf, sample + HALF - 50, sizeof buf, HALF - 50, "test.txt");
+  CHECK (pread (handle, buf, sizeof buf, sizeof sample - 1) == 0,
+         "pread at end of file");
+  CHECK (tell (handle) == 0, "tell \"test.txt\" after pread");
+
+  CHECK (pread (handle, buf, sizeof buf, -1) == -1,
+         "pread at negative offset");
+  msg ("close \"test.txt\"");
+  close (handle);
+
+  check_file ("test.txt", sample, sizeof sample - 1);
+}
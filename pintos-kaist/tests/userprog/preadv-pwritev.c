@@ -0,0 +1,41 @@
+/* Writes "sample.txt"'s contents to a new file at offset 100
+   with pwritev(), then reads them back with preadv() into
+   buffers split at different points, and checks that neither
+   moved the file position. */
+
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[sizeof sample - 1];
+
+void
+test_main (void) 
+{
+  struct iovec iov[2];
+  int handle, byte_cnt;
+
+  CHECK (create ("test.txt", 0), "create \"test.txt\"");
+  CHECK ((handle = open ("test.txt")) > 1, "open \"test.txt\"");
+
+  iov[0].iov_base = sample;
+  iov[0].iov_len = 200;
+  iov[1].iov_base = sample + 200;
+  iov[1].iov_len = sizeof sample - 1 - 200;
+  byte_cnt = pwritev (handle, iov, 2, 100);
+  if (byte_cnt != sizeof sample - 1)
+    fail ("pwritev() returned %d instead of %zu", byte_cnt, sizeof sample - 1);
+  CHECK (filesize (handle) == 100 + sizeof sample - 1,
+         "filesize \"test.txt\"");
+
+  iov[0].iov_base = buf;
+  iov[0].iov_len = 17;
+  iov[1].iov_base = buf + 17;
+  iov[1].iov_len = sizeof buf - 17;
+  byte_cnt = preadv (handle, iov, 2, 100);
+  if (byte_cnt != sizeof buf)
+    fail ("preadv() returned %d instead of %zu", byte_cnt, sizeof buf);
+  compare_bytes (buf, sample, sizeof buf, 100, "test.txt");
+  CHECK (tell (handle) == 0, "tell \"test.txt\"");
+}
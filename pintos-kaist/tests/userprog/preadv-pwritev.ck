@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(preadv-pwritev) begin
+(preadv-pwritev) create "test.txt"
+(preadv-pwritev) open "test.txt"
+(preadv-pwritev) filesize "test.txt"
+(preadv-pwritev) tell "test.txt"
+(preadv-pwritev) end
+preadv-pwritev: exit(0)
+EOF
+pass;
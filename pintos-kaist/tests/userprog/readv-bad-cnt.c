@@ -0,0 +1,31 @@
+/* Passes buffer counts of 0, -1 and IOV_MAX + 1 to readv() and
+   writev(), which must fail without touching the file. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[IOV_MAX + 1];
+static struct iovec iov[IOV_MAX + 1];
+
+void
+test_main (void) 
+{
+  int handle;
+  int i;
+
+  for (i = 0; i < IOV_MAX + 1; i++)
+    {
+      iov[i].iov_base = buf + i;
+      iov[i].iov_len = 1;
+    }
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK (readv (handle, iov, 0) == -1, "readv 0 buffers");
+  CHECK (readv (handle, iov, -1) == -1, "readv -1 buffers");
+  CHECK (readv (handle, iov, IOV_MAX + 1) == -1, "readv IOV_MAX + 1 buffers");
+  CHECK (writev (handle, iov, IOV_MAX + 1) == -1,
+         "writev IOV_MAX + 1 buffers");
+  CHECK (tell (handle) == 0, "tell \"sample.txt\"");
+  CHECK (readv (handle, iov, IOV_MAX) == IOV_MAX, "readv IOV_MAX buffers");
+}
@@ -0,0 +1,32 @@
+/* Reads "sample.txt" with readv() into three buffers of
+   different sizes, the last larger than what is left, and
+   checks that they were filled in order. */
+
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[sizeof sample + 100];
+
+void
+test_main (void) 
+{
+  struct iovec iov[3];
+  int handle, byte_cnt;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+
+  iov[0].iov_base = buf;
+  iov[0].iov_len = 10;
+  iov[1].iov_base = buf + 10;
+  iov[1].iov_len = 100;
+  iov[2].iov_base = buf + 110;
+  iov[2].iov_len = sizeof buf - 110;
+  byte_cnt = readv (handle, iov, 3);
+  if (byte_cnt != sizeof sample - 1)
+    fail ("readv() returned %d instead of %zu", byte_cnt, sizeof sample - 1);
+  compare_bytes (buf, sample, sizeof sample - 1, 0, "sample.txt");
+
+  CHECK (readv (handle, iov, 3) == 0, "readv at end of file");
+}
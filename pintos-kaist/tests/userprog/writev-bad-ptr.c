@@ -0,0 +1,23 @@
+/* Passes writev() a buffer that points into kernel memory.
+   The process must be terminated with -1 exit code. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  struct iovec iov[2];
+  int handle;
+
+  CHECK (create ("test.txt", 0), "create \"test.txt\"");
+  CHECK ((handle = open ("test.txt")) > 1, "open \"test.txt\"");
+
+  iov[0].iov_base = "abc";
+  iov[0].iov_len = 3;
+  iov[1].iov_base = (char *) 0x8004000000;
+  iov[1].iov_len = 123;
+  writev (handle, iov, 2);
+  fail ("should not have survived writev()");
+}
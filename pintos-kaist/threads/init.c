@@ -36,6 +36,7 @@
 #include "devices/disk.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/journal.h"
 #endif
 
 /* Page-map-level-4 with kernel mappings only. */
@@ -221,6 +222,16 @@ parse_options (char **argv) {
 			random_init (atoi (value));
 		else if (!strcmp (name, "-mlfqs"))
 			thread_mlfqs = true;
+#ifdef FILESYS
+		else if (!strcmp (name, "-pio"))
+			disk_pio_only = true;
+		else if (!strcmp (name, "-jcrash"))
+			journal_crash = true;
+#endif
+#ifdef VM
+		else if (!strcmp (name, "-swap"))
+			swap_disk_names = value;
+#endif
 #ifdef USERPROG
 		else if (!strcmp (name, "-ul"))
 			user_page_limit = atoi (value);
@@ -326,8 +337,16 @@ usage (void) {
 			"  -f                 Format file system disk during startup.\n"
 			"  -rs=SEED           Set random number seed to SEED.\n"
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
+#ifdef FILESYS
+			"  -pio               Use PIO instead of DMA for disk transfers.\n"
+			"  -jcrash            Leave the last journal transaction unapplied\n"
+			"                     at shutdown, to test replay on next boot.\n"
+#endif
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+			"  -swap=DISK[,DISK]  Stripe swap across DISKs, e.g. hd1:0,hd1:1.\n"
 #endif
 			);
 	power_off ();
@@ -354,6 +373,7 @@ static void
 print_stats (void) {
 	timer_print_stats ();
 	thread_print_stats ();
+	intr_print_stats ();
 #ifdef FILESYS
 	disk_print_stats ();
 #endif
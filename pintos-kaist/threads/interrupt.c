@@ -103,6 +103,56 @@ static const char *intr_names[INTR_CNT];
 static bool in_external_intr;   /* Are we processing an external interrupt? */
 static bool yield_on_return;    /* Should we yield on interrupt return? */
 
+/* Number of buckets in the duration histograms below.  Bucket I
+   counts durations from 2**I up to 2**(I+1) TSC cycles, the last
+   bucket everything longer. */
+#define INTR_HIST_BUCKETS 32
+
+/* How often something happened and how long it took. */
+struct intr_stats {
+	uint64_t cnt;               /* Number of times. */
+	uint64_t cycles;            /* Total duration, in TSC cycles. */
+	uint64_t max_cycles;        /* Longest duration, in TSC cycles. */
+	uint64_t hist[INTR_HIST_BUCKETS]; /* Duration histogram. */
+};
+
+/* Time spent in the handler for each interrupt vector.  Handlers
+   that run with interrupts on, such as system calls and page
+   faults, may sleep, so for them this is wall-clock time,
+   including any time spent blocked. */
+static struct intr_stats handler_stats[INTR_CNT];
+
+/* Interrupts-off sections.  A section starts when intr_disable()
+   or intr_set_level() turns interrupts off and ends when
+   intr_enable() or intr_set_level() turns them back on, possibly
+   in another thread after a context switch.  Sections that end
+   some other way, such as with the idle thread's "sti", are not
+   counted. */
+static struct intr_stats off_stats;
+static uint64_t off_start;      /* TSC at start of section, 0 if none. */
+static void *off_rip;           /* Where the section started. */
+
+/* A place that turned interrupts off, with its sections' times.
+   Only the INTR_OFF_SITES sites with the longest sections are
+   kept; a site that is pushed out and comes back starts over. */
+struct intr_off_site {
+	void *disable_rip;          /* Caller that turned interrupts off. */
+	void *enable_rip;           /* Caller that ended the longest section. */
+	uint64_t cnt;               /* Number of sections. */
+	uint64_t cycles;            /* Total duration, in TSC cycles. */
+	uint64_t max_cycles;        /* Longest section, in TSC cycles. */
+};
+#define INTR_OFF_SITES 16
+static struct intr_off_site off_sites[INTR_OFF_SITES];
+
+/* Number of sites printed by intr_print_stats(). */
+#define INTR_OFF_SITES_PRINT 8
+
+static enum intr_level enable (void *caller);
+static enum intr_level disable (void *caller);
+static void record (struct intr_stats *, uint64_t cycles);
+static void record_off (uint64_t cycles, void *enable_rip);
+
 /* Programmable Interrupt Controller helpers. */
 static void pic_init (void);
 static void pic_end_of_interrupt (int irq);
@@ -128,15 +178,32 @@ intr_get_level (void) {
    returns the previous interrupt status. */
 enum intr_level
 intr_set_level (enum intr_level level) {
-	return level == INTR_ON ? intr_enable () : intr_disable ();
+	void *caller = __builtin_return_address (0);
+	return level == INTR_ON ? enable (caller) : disable (caller);
 }
 
 /* Enables interrupts and returns the previous interrupt status. */
 enum intr_level
 intr_enable (void) {
+	return enable (__builtin_return_address (0));
+}
+
+/* Disables interrupts and returns the previous interrupt status. */
+enum intr_level
+intr_disable (void) {
+	return disable (__builtin_return_address (0));
+}
+
+/* Enables interrupts on behalf of CALLER and returns the previous
+   interrupt status. */
+static enum intr_level
+enable (void *caller) {
 	enum intr_level old_level = intr_get_level ();
 	ASSERT (!intr_context ());
 
+	if (old_level == INTR_OFF && off_start != 0)
+		record_off (rdtsc () - off_start, caller);
+
 	/* Enable interrupts by setting the interrupt flag.
 
 	   See [IA32-v2b] "STI" and [IA32-v3a] 5.8.1 "Masking Maskable
@@ -146,9 +213,10 @@ intr_enable (void) {
 	return old_level;
 }
 
-/* Disables interrupts and returns the previous interrupt status. */
-enum intr_level
-intr_disable (void) {
+/* Disables interrupts on behalf of CALLER and returns the
+   previous interrupt status. */
+static enum intr_level
+disable (void *caller) {
 	enum intr_level old_level = intr_get_level ();
 
 	/* Disable interrupts by clearing the interrupt flag.
@@ -156,9 +224,62 @@ intr_disable (void) {
 	   Hardware Interrupts". */
 	asm volatile ("cli" : : : "memory");
 
+	if (old_level == INTR_ON) {
+		off_start = rdtsc ();
+		off_rip = caller;
+	}
+
 	return old_level;
 }
 
+/* Adds a duration of CYCLES to S. */
+static void
+record (struct intr_stats *s, uint64_t cycles) {
+	size_t bucket = 0;
+
+	while (bucket + 1 < INTR_HIST_BUCKETS && cycles >> (bucket + 1) != 0)
+		bucket++;
+
+	s->cnt++;
+	s->cycles += cycles;
+	if (cycles > s->max_cycles)
+		s->max_cycles = cycles;
+	s->hist[bucket]++;
+}
+
+/* Ends the current interrupts-off section, which lasted CYCLES
+   and was ended by a call from ENABLE_RIP.  Must be called with
+   interrupts off. */
+static void
+record_off (uint64_t cycles, void *enable_rip) {
+	struct intr_off_site *site, *victim = NULL;
+
+	record (&off_stats, cycles);
+	off_start = 0;
+
+	for (site = off_sites; site < off_sites + INTR_OFF_SITES; site++) {
+		if (site->disable_rip == off_rip)
+			break;
+		if (victim == NULL || site->max_cycles < victim->max_cycles)
+			victim = site;
+	}
+	if (site >= off_sites + INTR_OFF_SITES) {
+		/* Not in the table.  Push out the site with the shortest
+		   longest section, if this section beats it. */
+		if (cycles <= victim->max_cycles)
+			return;
+		site = victim;
+		*site = (struct intr_off_site) { .disable_rip = off_rip };
+	}
+
+	site->cnt++;
+	site->cycles += cycles;
+	if (cycles > site->max_cycles) {
+		site->max_cycles = cycles;
+		site->enable_rip = enable_rip;
+	}
+}
+
 /* Initializes the interrupt system. */
 void
 intr_init (void) {
@@ -332,6 +453,18 @@ void
 intr_handler (struct intr_frame *frame) {
 	bool external;
 	intr_handler_func *handler;
+	enum intr_level level;
+	uint64_t start = rdtsc ();
+
+	/* If we interrupted code that had interrupts on, then the last
+	   interrupts-off section ended without going through
+	   intr_enable(), e.g. by returning to user mode or by the idle
+	   thread's "sti".  Forget it, so that a later intr_enable()
+	   in a handler that was entered with interrupts off, such as
+	   the page fault handler, doesn't charge it the whole time
+	   since. */
+	if (frame->eflags & FLAG_IF)
+		off_start = 0;
 
 	/* External interrupts are special.
 	   We only handle one at a time (so interrupts must be off)
@@ -361,6 +494,17 @@ intr_handler (struct intr_frame *frame) {
 		PANIC ("Unexpected interrupt");
 	}
 
+	/* A handler that runs with interrupts on can be preempted, and
+	   another thread can enter the same vector meanwhile, so update
+	   its statistics with interrupts off.  "cli" and "sti" are used
+	   directly so that this is not counted as an interrupts-off
+	   section. */
+	level = intr_get_level ();
+	asm volatile ("cli" : : : "memory");
+	record (&handler_stats[frame->vec_no], rdtsc () - start);
+	if (level == INTR_ON)
+		asm volatile ("sti" : : : "memory");
+
 	/* Complete the processing of an external interrupt. */
 	if (external) {
 		ASSERT (intr_get_level () == INTR_OFF);
@@ -403,3 +547,65 @@ const char *
 intr_name (uint8_t vec) {
 	return intr_names[vec];
 }
+
+/* Returns the number of TSC cycles under which at least 99% of
+   the durations in S fell, going by its histogram. */
+static uint64_t
+p99_cycles (const struct intr_stats *s) {
+	uint64_t below = 0;
+	size_t bucket;
+
+	for (bucket = 0; bucket + 1 < INTR_HIST_BUCKETS; bucket++) {
+		below += s->hist[bucket];
+		if (below * 100 >= s->cnt * 99)
+			break;
+	}
+	return bucket + 1 < INTR_HIST_BUCKETS ? 2ull << bucket : s->max_cycles;
+}
+
+/* Prints one line of statistics S, after NAME. */
+static void
+print_intr_stats (const char *name, const struct intr_stats *s) {
+	printf ("%s: %"PRIu64" times, mean %"PRIu64" ns, "
+			"99%% under %"PRIu64" ns, max %"PRIu64" ns\n",
+			name, s->cnt, clock_cycles_to_ns (s->cycles / s->cnt),
+			clock_cycles_to_ns (p99_cycles (s)),
+			clock_cycles_to_ns (s->max_cycles));
+}
+
+/* Prints interrupt statistics: for each interrupt that occurred,
+   how long its handler took, then how long interrupts were kept
+   off and by whom.  The addresses can be turned into source
+   locations with the "backtrace" utility. */
+void
+intr_print_stats (void) {
+	struct intr_off_site sites[INTR_OFF_SITES];
+	char name[96];
+	int vec;
+	int i, j;
+
+	for (vec = 0; vec < INTR_CNT; vec++)
+		if (handler_stats[vec].cnt > 0) {
+			snprintf (name, sizeof name, "Interrupt %#04x (%s)",
+					vec, intr_names[vec]);
+			print_intr_stats (name, &handler_stats[vec]);
+		}
+
+	if (off_stats.cnt == 0)
+		return;
+	print_intr_stats ("Interrupts off", &off_stats);
+
+	/* Longest sections first. */
+	for (i = 0; i < INTR_OFF_SITES; i++) {
+		struct intr_off_site site = off_sites[i];
+		for (j = i; j > 0 && sites[j - 1].max_cycles < site.max_cycles; j--)
+			sites[j] = sites[j - 1];
+		sites[j] = site;
+	}
+	for (i = 0; i < INTR_OFF_SITES_PRINT && sites[i].cnt > 0; i++)
+		printf ("  off at %p, on at %p: %"PRIu64" times, "
+				"mean %"PRIu64" ns, max %"PRIu64" ns\n",
+				sites[i].disable_rip, sites[i].enable_rip, sites[i].cnt,
+				clock_cycles_to_ns (sites[i].cycles / sites[i].cnt),
+				clock_cycles_to_ns (sites[i].max_cycles));
+}
@@ -162,8 +162,10 @@ void thread_tick(void)
 	else
 		kernel_ticks++;
 
-	/* Enforce preemption. */
-	if (++thread_ticks >= TIME_SLICE)
+	/* Enforce preemption.  The idle thread gives way as soon as
+	   any thread is ready anyway, and its ticks may be counted
+	   after the fact, outside the timer interrupt. */
+	if (t != idle_thread && ++thread_ticks >= TIME_SLICE)
 		intr_yield_on_return();
 }
 
@@ -207,6 +209,18 @@ void thread_wakeup(int64_t current_ticks)
 	intr_set_level(old_level);
 }
 
+/* Returns the tick at which the first sleeping thread wakes up,
+   or INT64_MAX if none is sleeping.  Must be called with
+   interrupts off. */
+int64_t thread_next_wakeup(void)
+{
+	ASSERT(intr_get_level() == INTR_OFF);
+
+	if (list_empty(&sleep_list))
+		return INT64_MAX;
+	return list_entry(list_front(&sleep_list), struct thread, elem)->wakeup_tick;
+}
+
 /* Prints thread statistics. */
 void thread_print_stats(void)
 {
@@ -483,10 +497,16 @@ idle(void *idle_started_ UNUSED)
 
 	for (;;)
 	{
-		/* Let someone else run. */
+		/* Let someone else run.  Restart the timer tick first,
+		   since someone else will need it. */
 		intr_disable();
+		timer_idle_exit();
 		thread_block();
 
+		/* Nobody else can run: stop the timer tick until a
+		   sleeping thread is due. */
+		timer_idle_enter();
+
 		/* Re-enable interrupts and wait for the next one.
 
 		   The `sti' instruction disables interrupts until the
@@ -1,4 +1,5 @@
 #include "userprog/process.h"
+#include <clock.h>
 #include <debug.h>
 #include <inttypes.h>
 #include <round.h>
@@ -8,6 +9,7 @@
 #include "userprog/gdt.h"
 #include "userprog/tss.h"
 #include "userprog/syscall.h"
+#include "devices/timer.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
@@ -152,6 +154,10 @@ duplicate_pte (uint64_t *pte, void *va, void *aux) {
 	if (is_kernel_vaddr(va))
 		return true;
 
+	// 시계 페이지는 복사하지 않고 __do_fork에서 공유 페이지를 다시 매핑
+	if (va == (void *) CLOCK_PAGE)
+		return true;
+
 	// 부모 프로세스의 페이지 테이블에서 해당 가상 주소에 대응하는 물리 주소를 가져옴
 	parent_page = pml4_get_page(parent->pml4, va);
 	if (parent_page == NULL)
@@ -179,6 +185,29 @@ duplicate_pte (uint64_t *pte, void *va, void *aux) {
 }
 #endif
 
+/* Maps the kernel's clock page read-only at CLOCK_PAGE in the
+ * current process, so that user code can read the clock without
+ * a system call.  The page is shared by every process. */
+static bool
+map_clock_page (void) {
+	void *kpage = timer_clock_page();
+
+	// 보정 전이라 페이지가 없으면 매핑하지 않음 (clock_monotonic 시스템 콜은 동작)
+	if (kpage == NULL)
+		return true;
+	return pml4_set_page(thread_current()->pml4, (void *) CLOCK_PAGE, kpage, false);
+}
+
+/* Returns true if the LENGTH bytes of user memory starting at
+ * ADDR overlap the clock page, which nothing else may map. */
+bool
+process_overlaps_clock_page (const void *addr, size_t length) {
+	uintptr_t start = (uintptr_t) addr;
+	uintptr_t clock = (uintptr_t) CLOCK_PAGE;
+
+	return start < clock + PGSIZE && (start >= clock || clock - start < length);
+}
+
 /* A thread function that copies parent's execution context.
  * Hint) parent->tf does not hold the userland context of the process.
  *       That is, you are required to pass second argument of process_fork to
@@ -215,6 +244,9 @@ __do_fork(void *aux) {
 	if (!pml4_for_each(parent->pml4, duplicate_pte, parent))
 		goto error;
 #endif
+	// 공유 시계 페이지 매핑 (부모의 페이지 테이블 복사와 별개)
+	if (!map_clock_page())
+		goto error;
 	// 파일 디스크립터 테이블(FDT) 복제
 	int fd_end = parent->next_FD;
 	for (int fd = 0; fd < fd_end; fd++) {
@@ -481,6 +513,9 @@ process_cleanup (void) {
 		 * that's been freed (and cleared). */
 		curr->pml4 = NULL;
 		pml4_activate (NULL);
+		/* The clock page is shared, so it must not be freed
+		 * along with the process's own pages. */
+		pml4_clear_page (pml4, (void *) CLOCK_PAGE);
 		pml4_destroy (pml4);
 	}
 }
@@ -575,7 +610,6 @@ load (const char *file_name, struct intr_frame *if_) {
 	process_activate (thread_current ());
 
 	/* Open executable file. */
-	lock_acquire(&filesys_lock);
 	file = filesys_open (file_name);
 	if (file == NULL) {
 		printf ("load: %s: open failed\n", file_name);
@@ -654,13 +688,16 @@ load (const char *file_name, struct intr_frame *if_) {
 	if (!setup_stack (if_))
 		goto done;
 
+	/* Map the clock page. */
+	if (!map_clock_page ())
+		goto done;
+
 	/* Start address. */
 	if_->rip = ehdr.e_entry;
 
 	success = true;
 	goto done;
 done:
-	lock_release(&filesys_lock);
 	return success;		  // load 성공 여부 반환	
 }
 
@@ -704,6 +741,11 @@ validate_segment (const struct Phdr *phdr, struct file *file) {
 	if (phdr->p_vaddr < PGSIZE)
 		return false;
 
+	/* The clock page is mapped above the stack; a segment may not
+	   take its place. */
+	if (process_overlaps_clock_page ((void *) phdr->p_vaddr, phdr->p_memsz))
+		return false;
+
 	/* It's okay. */
 	return true;
 }
@@ -1,5 +1,7 @@
 #include "userprog/syscall.h"
+#include <limits.h>
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
@@ -15,10 +17,11 @@
 #include "filesys/directory.h"      // 디렉터리 관련 자료구조 및 함수 (디렉터리 열기, 탐색 등)
 #include "filesys/filesys.h"        // 파일 시스템 전반에 대한 함수 및 초기화/포맷 인터페이스
 #include "filesys/file.h"           // 개별 파일 객체(file 구조체) 및 파일 입출력 함수 정의 (read, write 등)
+#include "filesys/inode.h"          // inode 번호 조회 및 재오픈 (getdents에서 디렉터리 확인)
+#include "devices/disk.h"           // 디스크별 I/O 통계 (disk_stats)
+#include "devices/timer.h"          // TSC 기반 단조 시계 (clock_monotonic)
 #include "vm/file.h"
 
-struct lock filesys_lock;
-
 void syscall_entry (void);
 void syscall_handler (struct intr_frame *);
 void check_address(void *addr);
@@ -37,6 +40,15 @@ static int sys_filesize(int fd);
 static int sys_read(int fd, void *buffer, unsigned size);
 static void sys_seek(int fd, unsigned position);
 static unsigned sys_tell(int fd);
+static int sys_readv(int fd, const struct iovec *iov, int iovcnt);
+static int sys_writev(int fd, const struct iovec *iov, int iovcnt);
+static int sys_pread(int fd, void *buffer, unsigned size, off_t offset);
+static int sys_pwrite(int fd, const void *buffer, unsigned size, off_t offset);
+static int sys_preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+static int sys_pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+static int sys_copy_file_range(int fd_in, off_t *off_in, int fd_out, off_t *off_out, size_t length);
+static int sys_getdents(int fd, struct dirent *buffer, unsigned size);
+static int sys_disk_stats(int chan_no, int dev_no, struct disk_stats *stats);
 
 void *sys_mmap(void *addr, size_t length, int writable, int fd, off_t offset);
 void sys_munmap(void *addr);
@@ -65,7 +77,6 @@ syscall_init (void) {
 	 * mode stack. Therefore, we masked the FLAG_FL. */
 	write_msr(MSR_SYSCALL_MASK,
 			FLAG_IF | FLAG_TF | FLAG_DF | FLAG_IOPL | FLAG_AC | FLAG_NT);
-	lock_init(&filesys_lock);
 }
 
 /* The main system call interface */
@@ -131,6 +142,36 @@ void syscall_handler(struct intr_frame *f UNUSED) {
 	case SYS_MUNMAP:
 		sys_munmap((void *)arg1);
 		break;
+	case SYS_READV:
+		f->R.rax = sys_readv((int)arg1, (const struct iovec *)arg2, (int)arg3);
+		break;
+	case SYS_WRITEV:
+		f->R.rax = sys_writev((int)arg1, (const struct iovec *)arg2, (int)arg3);
+		break;
+	case SYS_PREAD:
+		f->R.rax = sys_pread((int)arg1, (void *)arg2, (unsigned)arg3, (off_t)arg4);
+		break;
+	case SYS_PWRITE:
+		f->R.rax = sys_pwrite((int)arg1, (const void *)arg2, (unsigned)arg3, (off_t)arg4);
+		break;
+	case SYS_PREADV:
+		f->R.rax = sys_preadv((int)arg1, (const struct iovec *)arg2, (int)arg3, (off_t)arg4);
+		break;
+	case SYS_PWRITEV:
+		f->R.rax = sys_pwritev((int)arg1, (const struct iovec *)arg2, (int)arg3, (off_t)arg4);
+		break;
+	case SYS_COPY_FILE_RANGE:
+		f->R.rax = sys_copy_file_range((int)arg1, (off_t *)arg2, (int)arg3, (off_t *)arg4, (size_t)arg5);
+		break;
+	case SYS_GETDENTS:
+		f->R.rax = sys_getdents((int)arg1, (struct dirent *)arg2, (unsigned)arg3);
+		break;
+	case SYS_DISK_STATS:
+		f->R.rax = sys_disk_stats((int)arg1, (int)arg2, (struct disk_stats *)arg3);
+		break;
+	case SYS_CLOCK_MONOTONIC:
+		f->R.rax = clock_monotonic();
+		break;
 
 	default:
 		thread_exit();
@@ -229,27 +270,10 @@ static bool sys_create(const char *file, unsigned initial_size) {
 		return false;
 	}
 
-	// 루트 디렉토리 열기 → Pintos는 루트 디렉토리를 기본 작업 디렉토리로 사용
-	struct dir *dir = dir_open_root();
-	if (dir == NULL) {
-		return false; // 루트 디렉토리 열기에 실패한 경우
-	}
-
-	struct inode *inode;
-
-	// 동일한 이름의 파일이 이미 존재하는지 확인
-    if (dir_lookup(dir, kernel_buf, &inode)) {
-		dir_close(dir);  // 디렉토리 닫기
-		return false;    // 이미 존재하는 파일 이름 → 생성 실패
-	}
-	
-	// 파일 시스템 락을 획득한 후 파일 생성 시도 (동시성 보호)
-	lock_acquire(&filesys_lock);
+	// 파일 생성 시도 (동기화는 파일 시스템 내부의 디렉터리/free map 락이 담당)
+	// 같은 이름의 파일이 이미 있으면 filesys_create()의 dir_add()가 실패하므로
+	// 여기서 따로 dir_lookup()으로 확인하지 않음
 	bool success = filesys_create(kernel_buf, initial_size);
-	lock_release(&filesys_lock);	// 작업 완료 이후 락 해제
-
-	// 디렉토리 자원 정리
-	dir_close(dir);
 
 	// 파일 생성 성공 여부 반환
 	return success;
@@ -264,9 +288,7 @@ static bool sys_remove(const char *file) {
 		return false;
 	}
 
-	lock_acquire(&filesys_lock);
 	bool success = filesys_remove(file);
-	lock_release(&filesys_lock);
 
 	// 파일 시스템에서 해당 파일 삭제 시도 후 성공/실패 여부 반환
 	return success;
@@ -276,17 +298,12 @@ static int sys_open(const char *file_name) {
 	// 사용자 포인터가 유효한 사용자 영역 주소인지 검사
 	validate_ptr(file_name, 1);
 
-	// 파일 시스템 접근을 위한 락 획득
-	lock_acquire(&filesys_lock);
-
 	// 파일 시스템에서 파일 열기 시도
 	struct file *file = filesys_open(file_name);
 
 	// 파일이 없거나 열기에 실패한 경우 -1 반환
-	if (file == NULL) {
-		lock_release(&filesys_lock);
+	if (file == NULL)
 		return -1;
-	}
 
 	// 현재 프로세스의 파일 디스크립터 테이블(FDT)에 파일 등록
 	int fd = process_add_file(file);
@@ -295,9 +312,6 @@ static int sys_open(const char *file_name) {
 	if (fd == -1)
 		file_close(file);
 
-	// 파일 시스템 락 해제
-	lock_release(&filesys_lock);
-
 	// 파일 디스크립터 번호 반환, 실패 시 -1 반환
 	return fd;
 }
@@ -305,15 +319,11 @@ static int sys_open(const char *file_name) {
 static void sys_close(int fd) {
 	struct thread *curr = thread_current();
 
-	lock_acquire(&filesys_lock);
-
 	struct file *file = process_get_file(fd);
 	if (file != NULL) {
 		file_close(file);
 		curr->FDT[fd] = NULL;
 	}
-
-	lock_release(&filesys_lock);
 }
 
 static int sys_filesize(int fd) {
@@ -343,9 +353,8 @@ static int sys_read(int fd, void *buffer, unsigned size) {
 	char *ptr = (char *)buffer;
 	int bytes_read = 0;
 
-	// 파일 시스템 동시 접근 방지를 위한 락 획득
-	lock_acquire(&filesys_lock);
-
+	// 파일 접근 동기화는 inode의 reader/writer 락이 담당하므로
+	// 여기서 전역 락을 잡지 않음 (다른 파일 읽기와 병렬로 진행 가능)
 	if (fd == STDIN_FILENO)  // 표준 입력일 경우
 	{
 		// 키보드 입력을 한 글자씩 읽어서 버퍼에 저장
@@ -353,27 +362,20 @@ static int sys_read(int fd, void *buffer, unsigned size) {
 			*ptr++ = input_getc();
 			bytes_read++;
 		}
-		lock_release(&filesys_lock);
 	}
 	else
 	{
 		// stdout(1), stderr(2), 음수 등 읽을 수 없는 fd는 실패 처리
-		if (fd < 3) {
-			lock_release(&filesys_lock);
+		if (fd < 3)
 			return -1;
-		}
 
 		// 파일 디스크립터 테이블에서 파일 객체 가져오기
 		struct file *file = process_get_file(fd);
-		if (file == NULL) {
-			lock_release(&filesys_lock);
+		if (file == NULL)
 			return -1;
-		}
 
 		// 파일에서 size만큼 읽어 버퍼에 저장
 		bytes_read = file_read(file, buffer, size);
-
-		lock_release(&filesys_lock);
 	}
 
 	// 읽은 바이트 수 반환 (0 이상)
@@ -397,19 +399,14 @@ static int sys_write(int fd, const void *buffer, unsigned size) {
 	}
 	
 	// 일반 파일인 경우 → 해당 fd로 열린 파일 객체 조회
+	// 디렉터리는 파일 시스템이 관리하는 메타데이터이므로 직접 쓸 수 없음
 	struct file *file = process_get_file(fd);
-	if (file == NULL)
+	if (file == NULL || inode_is_dir(file_get_inode(file)))
 		return -1;
 
-	// 파일 시스템 접근을 위한 락 획득
-	lock_acquire(&filesys_lock);
-
-	// 파일에 버퍼 내용 쓰기
+	// 파일에 버퍼 내용 쓰기 (inode 쓰기 락으로 같은 파일에 대한 쓰기만 직렬화됨)
 	int bytes_write = file_write(file, buffer, size);
 
-	// 락 해제
-	lock_release(&filesys_lock);
-
 	// 쓰기 실패 시 -1 반환
 	if (bytes_write < 0)
 		return -1;
@@ -444,6 +441,284 @@ static unsigned sys_tell(int fd)
 	return file_tell(file);
 }
 
+// 커널로 복사해 둔 iovec 배열의 각 버퍼가 유저 영역인지 검증
+// for_read가 참이면 커널이 버퍼에 쓰게 되므로 읽기 전용 페이지도 거부
+// (페이지의 쓰기 가능 여부는 VM에서만 알 수 있으므로 그 외에는 쓰이지 않음)
+static void validate_iov(const struct iovec *kiov, int iovcnt, bool for_read UNUSED) {
+	for (int i = 0; i < iovcnt; i++) {
+		if (kiov[i].iov_len == 0)
+			continue;
+		validate_ptr(kiov[i].iov_base, kiov[i].iov_len);
+#ifdef VM
+		if (for_read) {
+			struct page *page = spt_find_page(&thread_current()->spt, kiov[i].iov_base);
+			if (page && !page->writable)
+				sys_exit(-1);
+		}
+#endif
+	}
+}
+
+// 유저의 iovec 배열을 커널 배열 kiov로 복사한 뒤 검증
+// iovcnt가 범위를 벗어나거나 길이의 합이 INT_MAX를 넘으면 false
+// (반환값이 int이고 각 버퍼는 off_t 크기로 파일에 전달되므로)
+static bool copy_in_iov(struct iovec *kiov, const struct iovec *iov, int iovcnt, bool for_read) {
+	size_t total = 0;
+
+	if (iovcnt <= 0 || iovcnt > IOV_MAX)
+		return false;
+
+	copy_in(kiov, iov, iovcnt * sizeof *kiov);
+	for (int i = 0; i < iovcnt; i++) {
+		if (kiov[i].iov_len > INT_MAX - total)
+			return false;
+		total += kiov[i].iov_len;
+	}
+	validate_iov(kiov, iovcnt, for_read);
+	return true;
+}
+
+// 이미 검증된 버퍼들(kiov)에 fd의 내용을 차례로 읽어 넣음
+// posp가 NULL이면 파일의 현재 위치에서 읽고 위치를 옮기며,
+// 아니면 *posp부터 읽고 파일 위치는 그대로 둠 (pread 계열)
+// 어느 버퍼에서든 덜 읽히면(EOF) 거기서 멈추고 지금까지 읽은 바이트 수를 반환
+static int do_readv(int fd, const struct iovec *kiov, int iovcnt, off_t *posp) {
+	int total = 0;
+
+	if (fd == STDIN_FILENO && posp == NULL) {
+		// 표준 입력은 위치가 없으므로 readv만 허용
+		for (int i = 0; i < iovcnt; i++) {
+			char *ptr = kiov[i].iov_base;
+			for (size_t j = 0; j < kiov[i].iov_len; j++)
+				*ptr++ = input_getc();
+			total += kiov[i].iov_len;
+		}
+		return total;
+	}
+
+	if (fd < 3)
+		return -1;
+	struct file *file = process_get_file(fd);
+	if (file == NULL)
+		return -1;
+
+	for (int i = 0; i < iovcnt; i++) {
+		off_t size = kiov[i].iov_len;
+		off_t bytes_read;
+
+		if (posp != NULL) {
+			bytes_read = file_read_at(file, kiov[i].iov_base, size, *posp);
+			*posp += bytes_read;
+		} else
+			bytes_read = file_read(file, kiov[i].iov_base, size);
+
+		total += bytes_read;
+		if (bytes_read < size)
+			break;
+	}
+	return total;
+}
+
+// do_readv의 쓰기 버전. 표준 출력은 버퍼마다 putbuf로 내보냄
+// 디스크가 가득 차는 등 덜 쓰이면 거기서 멈춤
+// sys_write와 마찬가지로 디렉터리에는 쓸 수 없음
+static int do_writev(int fd, const struct iovec *kiov, int iovcnt, off_t *posp) {
+	int total = 0;
+
+	if (fd == STDOUT_FILENO && posp == NULL) {
+		for (int i = 0; i < iovcnt; i++) {
+			putbuf(kiov[i].iov_base, kiov[i].iov_len);
+			total += kiov[i].iov_len;
+		}
+		return total;
+	}
+
+	if (fd < 3)
+		return -1;
+	struct file *file = process_get_file(fd);
+	if (file == NULL || inode_is_dir(file_get_inode(file)))
+		return -1;
+
+	for (int i = 0; i < iovcnt; i++) {
+		off_t size = kiov[i].iov_len;
+		off_t bytes_write;
+
+		if (posp != NULL) {
+			bytes_write = file_write_at(file, kiov[i].iov_base, size, *posp);
+			*posp += bytes_write;
+		} else
+			bytes_write = file_write(file, kiov[i].iov_base, size);
+
+		total += bytes_write;
+		if (bytes_write < size)
+			break;
+	}
+	return total;
+}
+
+static int sys_readv(int fd, const struct iovec *iov, int iovcnt) {
+	struct iovec kiov[IOV_MAX];
+
+	// 여러 버퍼를 한 번의 커널 진입으로 채움
+	if (!copy_in_iov(kiov, iov, iovcnt, true))
+		return -1;
+	return do_readv(fd, kiov, iovcnt, NULL);
+}
+
+static int sys_writev(int fd, const struct iovec *iov, int iovcnt) {
+	struct iovec kiov[IOV_MAX];
+
+	if (!copy_in_iov(kiov, iov, iovcnt, false))
+		return -1;
+	return do_writev(fd, kiov, iovcnt, NULL);
+}
+
+static int sys_pread(int fd, void *buffer, unsigned size, off_t offset) {
+	// seek + read를 한 번에: 파일 위치는 바뀌지 않음
+	struct iovec kiov = { buffer, size };
+
+	if (offset < 0 || size > INT_MAX)
+		return -1;
+	validate_iov(&kiov, 1, true);
+	return do_readv(fd, &kiov, 1, &offset);
+}
+
+static int sys_pwrite(int fd, const void *buffer, unsigned size, off_t offset) {
+	struct iovec kiov = { (void *)buffer, size };
+
+	if (offset < 0 || size > INT_MAX)
+		return -1;
+	validate_iov(&kiov, 1, false);
+	return do_writev(fd, &kiov, 1, &offset);
+}
+
+static int sys_preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset) {
+	struct iovec kiov[IOV_MAX];
+
+	if (offset < 0 || !copy_in_iov(kiov, iov, iovcnt, true))
+		return -1;
+	return do_readv(fd, kiov, iovcnt, &offset);
+}
+
+static int sys_pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset) {
+	struct iovec kiov[IOV_MAX];
+
+	if (offset < 0 || !copy_in_iov(kiov, iov, iovcnt, false))
+		return -1;
+	return do_writev(fd, kiov, iovcnt, &offset);
+}
+
+static int sys_copy_file_range(int fd_in, off_t *off_in, int fd_out, off_t *off_out, size_t length) {
+	// 파일 간 복사를 커널 안에서 처리: 유저 버퍼를 거치지 않으므로
+	// 청크마다 validate_ptr/copy_in을 반복할 필요가 없음
+	struct file *in = process_get_file(fd_in);
+	struct file *out = process_get_file(fd_out);
+	off_t in_ofs, out_ofs;
+
+	if (fd_in < 3 || fd_out < 3 || in == NULL || out == NULL)
+		return -1;
+	// 디렉터리는 내용을 복사해 올 수도, 덮어쓸 수도 없음
+	if (inode_is_dir(file_get_inode(in)) || inode_is_dir(file_get_inode(out)))
+		return -1;
+
+	// 오프셋 포인터가 NULL이면 파일의 현재 위치를 쓰고 그만큼 옮김 (read/write처럼)
+	// 아니면 *off_in / *off_out을 쓰고 갱신하며 파일 위치는 그대로 둠
+	if (off_in != NULL)
+		copy_in(&in_ofs, off_in, sizeof in_ofs);
+	else
+		in_ofs = file_tell(in);
+	if (off_out != NULL)
+		copy_in(&out_ofs, off_out, sizeof out_ofs);
+	else
+		out_ofs = file_tell(out);
+	if (in_ofs < 0 || out_ofs < 0)
+		return -1;
+
+	// off_t 범위를 넘지 않도록 한 번에 복사할 길이를 제한
+	if (length > INT32_MAX)
+		length = INT32_MAX;
+
+	off_t bytes_copied = file_copy_range(in, in_ofs, out, out_ofs, length);
+	if (bytes_copied < 0)
+		return -1;
+
+	in_ofs += bytes_copied;
+	out_ofs += bytes_copied;
+	if (off_in != NULL)
+		copy_out(off_in, &in_ofs, sizeof in_ofs);
+	else
+		file_seek(in, in_ofs);
+	if (off_out != NULL)
+		copy_out(off_out, &out_ofs, sizeof out_ofs);
+	else
+		file_seek(out, out_ofs);
+
+	return bytes_copied;
+}
+
+static int sys_getdents(int fd, struct dirent *buffer, unsigned size) {
+	struct file *file = process_get_file(fd);
+
+	// 현재 트리에는 하위 디렉터리가 없으므로 디렉터리는 루트뿐 ("/"로 열 수 있음)
+	if (fd < 3 || file == NULL || !inode_is_dir(file_get_inode(file)))
+		return -1;
+
+	// 버퍼에 들어가는 만큼만, 그리고 커널 페이지 하나에 담기는 만큼만 한 번에 읽음
+	size_t max = size / sizeof(struct dirent);
+	if (max > PGSIZE / sizeof(struct dir_record))
+		max = PGSIZE / sizeof(struct dir_record);
+	if (max == 0)
+		return -1;
+
+	validate_ptr(buffer, max * sizeof(struct dirent));
+#ifdef VM
+	struct page *page = spt_find_page(&thread_current()->spt, buffer);
+	if (page && !page->writable)
+		sys_exit(-1);
+#endif
+
+	struct dir_record *records = palloc_get_page(0);
+	if (records == NULL)
+		return -1;
+	struct dir *dir = dir_open(inode_reopen(file_get_inode(file)));
+	if (dir == NULL) {
+		palloc_free_page(records);
+		return -1;
+	}
+
+	// 디렉터리 읽기 위치는 fd의 파일 위치에 보관 → 다음 호출이 이어서 읽음
+	dir_seek(dir, file_tell(file));
+	size_t cnt = dir_readdir_batch(dir, records, max);
+	file_seek(file, dir_tell(dir));
+	dir_close(dir);
+
+	// 디렉터리 블록 단위로 모은 항목들을 유저 버퍼의 dirent 레코드로 변환
+	for (size_t i = 0; i < cnt; i++) {
+		struct dirent d;
+
+		memset(&d, 0, sizeof d);
+		d.d_ino = records[i].inode_sector;
+		d.d_type = DT_REG;
+		strlcpy(d.d_name, records[i].name, sizeof d.d_name);
+		copy_out(&buffer[i], &d, sizeof d);
+	}
+	palloc_free_page(records);
+
+	// 읽은 항목 수 반환, 0이면 디렉터리 끝
+	return cnt;
+}
+
+static int sys_disk_stats(int chan_no, int dev_no, struct disk_stats *stats) {
+	// 인터럽트를 끈 채로 커널 버퍼에 복사한 뒤 유저 버퍼로 옮긴다
+	struct disk_stats kernel_stats;
+
+	validate_ptr(stats, sizeof *stats);
+	if (!disk_get_stats(chan_no, dev_no, &kernel_stats))
+		return -1;
+	copy_out(stats, &kernel_stats, sizeof kernel_stats);
+	return 0;
+}
+
 void *
 sys_mmap(void *addr, size_t length, int writable, int fd, off_t offset) {
     if (!addr || pg_round_down(addr) != addr || is_kernel_vaddr(addr) || is_kernel_vaddr(addr + length))
@@ -455,11 +730,16 @@ sys_mmap(void *addr, size_t length, int writable, int fd, off_t offset) {
     if (spt_find_page(&thread_current()->spt, addr))
         return NULL;
 
+    // 시계 페이지와 겹치는 범위는 매핑할 수 없음
+    if (process_overlaps_clock_page(addr, length))
+        return NULL;
+
 	if (fd < 3)
         return NULL;
 
+    // 디렉터리를 매핑하면 munmap 때 그 내용을 덮어쓰게 되므로 거부
     struct file *file = process_get_file(fd);
-    if (file == NULL || file_length(file) == 0 || (long)length <= 0)
+    if (file == NULL || inode_is_dir(file_get_inode(file)) || file_length(file) == 0 || (long)length <= 0)
         return NULL;
 
     return do_mmap(addr, length, writable, file, offset);
@@ -3,14 +3,30 @@
 #include "vm/vm.h"
 #include "devices/disk.h"
 #include <bitmap.h>
+#include <round.h>
+#include <string.h>
 #include "threads/vaddr.h"
 #include "threads/mmu.h"
 
 #define SECTOR_PER_PAGE (PGSIZE / DISK_SECTOR_SIZE)
 
+/* Most disks that swap is striped across. */
+#define SWAP_DISK_MAX 4
+
 static struct bitmap *swap_table;
 static struct lock swap_lock;
 
+/* Swap disks, named by the -swap option, hd1:1 by default.  Each
+   swap slot holds one page, split into pieces of SWAP_UNIT
+   sectors, the first piece on the first disk, the next on the
+   next, and so on, at sector SLOT * SWAP_UNIT of each.  The
+   pieces are transferred at the same time, so that disks on
+   different channels work on a page together. */
+char *swap_disk_names;
+static struct disk *swap_disks[SWAP_DISK_MAX];
+static size_t swap_disk_cnt;
+static size_t swap_unit;
+
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
 static bool anon_swap_in (struct page *page, void *kva);
@@ -25,14 +41,82 @@ static const struct page_operations anon_ops = {
 	.type = VM_ANON,
 };
 
+/* Adds the disk named NAME, such as "hd1:1", to the swap
+   disks.  Panics if there is no such disk. */
+static void
+add_swap_disk (const char *name) {
+	struct disk *d = NULL;
+	size_t i;
+
+	if (strlen(name) == 5 && !memcmp(name, "hd", 2) && name[3] == ':'
+			&& (name[2] == '0' || name[2] == '1')
+			&& (name[4] == '0' || name[4] == '1'))
+		d = disk_get(name[2] - '0', name[4] - '0');
+	if (d == NULL || d == disk_get(0, 0) || d == disk_get(0, 1))
+		PANIC ("-swap: `%s' is not a usable disk", name);
+	for (i = 0; i < swap_disk_cnt; i++)
+		if (swap_disks[i] == d)
+			return;
+	if (swap_disk_cnt >= SWAP_DISK_MAX)
+		PANIC ("-swap: more than %d disks", SWAP_DISK_MAX);
+	swap_disks[swap_disk_cnt++] = d;
+}
+
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
-	swap_disk = disk_get(1, 1);
-	swap_table = bitmap_create(disk_size(swap_disk) / SECTOR_PER_PAGE);
+	size_t slot_cnt = 0;
+	size_t i;
+
+	if (swap_disk_names != NULL) {
+		char *name, *save_ptr;
+		for (name = strtok_r(swap_disk_names, ",", &save_ptr); name != NULL;
+				name = strtok_r(NULL, ",", &save_ptr))
+			add_swap_disk(name);
+	} else if (disk_get(1, 1) != NULL)
+		add_swap_disk("hd1:1");
+	swap_disk = swap_disk_cnt > 0 ? swap_disks[0] : NULL;
+
+	// 슬롯 수는 가장 작은 스왑 디스크가 정한다
+	if (swap_disk_cnt > 0) {
+		swap_unit = DIV_ROUND_UP(SECTOR_PER_PAGE, swap_disk_cnt);
+		slot_cnt = disk_size(swap_disks[0]) / swap_unit;
+		for (i = 1; i < swap_disk_cnt; i++)
+			if (disk_size(swap_disks[i]) / swap_unit < slot_cnt)
+				slot_cnt = disk_size(swap_disks[i]) / swap_unit;
+	}
+	swap_table = bitmap_create(slot_cnt);
 	lock_init(&swap_lock);
 }
 
+/* Transfers the page in swap slot SLOT from KVA to the swap disks
+   if WRITE is true, or from them to KVA otherwise.  Starts every
+   disk's piece before waiting for any.  Returns false if a disk
+   reported an error. */
+static bool
+swap_transfer (size_t slot, void *kva, bool write) {
+	struct disk_request requests[SWAP_DISK_MAX];
+	enum disk_origin old_origin = disk_set_origin(DISK_SWAP);
+	size_t n = 0;
+	bool success = true;
+
+	for (size_t i = 0; i < swap_disk_cnt; i++) {
+		size_t ofs = i * swap_unit;
+		if (ofs >= SECTOR_PER_PAGE)
+			break;
+		size_t cnt = SECTOR_PER_PAGE - ofs < swap_unit ? SECTOR_PER_PAGE - ofs : swap_unit;
+		disk_request_init(&requests[n], slot * swap_unit,
+				(uint8_t *) kva + ofs * DISK_SECTOR_SIZE, cnt, write, NULL, NULL);
+		disk_submit(swap_disks[i], &requests[n]);
+		n++;
+	}
+	for (size_t i = 0; i < n; i++)
+		if (!disk_wait(&requests[i]))
+			success = false;
+	disk_set_origin(old_origin);
+	return success;
+}
+
 /* Initialize the file mapping */
 bool
 anon_initializer (struct page *page, enum vm_type type, void *kva) {
@@ -60,22 +144,25 @@ anon_swap_in (struct page *page, void *kva) {
 		lock_release(&swap_lock);	
 		return false;
 	}
+	lock_release(&swap_lock);
 
-	for (size_t i = 0; i < SECTOR_PER_PAGE; i++)
-		disk_read(swap_disk, (anon_page->page_no * SECTOR_PER_PAGE) + i, kva + (i * DISK_SECTOR_SIZE));
+	// 슬롯은 이 페이지 소유이므로 락 없이 읽는다 (다른 스왑 I/O와 동시에 진행)
+	// 디스크 오류로 읽지 못했으면 내용을 잃은 것이므로 슬롯을 비우고 실패 처리
+	bool success = swap_transfer(anon_page->page_no, kva, false);
 
+	lock_acquire(&swap_lock);
 	bitmap_set(swap_table, anon_page->page_no, false);
-
 	lock_release(&swap_lock);
 	anon_page->page_no = BITMAP_ERROR;
 
-	return true;
+	return success;
 }
 
 /* Swap out the page by writing contents to the swap disk. */
 static bool
 anon_swap_out (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+	uint64_t *pml4 = page->owner->pml4;
 	/** Project 3-Swap In/Out */
 	lock_acquire(&swap_lock);
 	size_t page_no = bitmap_scan_and_flip(swap_table, 0, 1, false);
@@ -84,14 +171,28 @@ anon_swap_out (struct page *page) {
 		lock_release(&swap_lock);
 		return false;
 	}
+	lock_release(&swap_lock);
 
-	for (size_t i = 0; i < SECTOR_PER_PAGE; i++)
-		disk_write(swap_disk, (page_no * SECTOR_PER_PAGE) + i, page->va + (i * DISK_SECTOR_SIZE));
+	// 쓰기 전에 소유자(현재 스레드가 아닐 수 있음)의 매핑부터 끊는다.
+	// 그래야 쓰는 도중의 저장이 폴트를 일으켜 vm_do_claim_page()에서 기다리게 되고,
+	// 디스크에 쓴 내용에서 빠지지 않는다. 익명 페이지는 스왑 인 때 슬롯을 비우므로
+	// 디스크에 깨끗한 사본이 없어, dirty 여부와 관계없이 항상 써야 한다.
+	pml4_clear_page(pml4, page->va);
+
+	// 슬롯을 잡은 뒤에는 락을 풀고 쓴다. 프레임의 커널 주소를 쓰는 이유는
+	// page->va가 다른 프로세스의 주소일 수 있기 때문이다.
+	// 쓰기에 실패하면 슬롯을 돌려주고 매핑을 되살려 페이지를 메모리에 그대로 둔다
+	if (!swap_transfer(page_no, page->frame->kva, true)) {
+		lock_acquire(&swap_lock);
+		bitmap_reset(swap_table, page_no);
+		lock_release(&swap_lock);
+		pml4_set_page(pml4, page->va, page->frame->kva, page->writable);
+		return false;
+	}
 	anon_page->page_no = page_no;
 	page->frame->page = NULL;
 	page->frame = NULL;
-	pml4_clear_page(thread_current()->pml4, page->va);
-	lock_release(&swap_lock);
+	return true;
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
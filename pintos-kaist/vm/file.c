@@ -44,9 +44,7 @@ file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
 static bool
 file_backed_swap_in (struct page *page, void *kva) {
 	struct file_page *file_page UNUSED = &page->file;
-    lock_acquire(&filesys_lock);
 	int read = file_read_at(file_page->file, page->frame->kva, file_page->read_bytes, file_page->ofs);
-    lock_release(&filesys_lock);
 	memset(page->frame->kva + read, 0, PGSIZE - read);
 	return true;
 }
@@ -57,17 +55,19 @@ file_backed_swap_out (struct page *page) {
 	struct file_page *file_page UNUSED = &page->file;
 	/** Project 3-Swap In/Out */
 	struct frame *frame = page->frame;
+	uint64_t *pml4 = page->owner->pml4;
 
-	if (pml4_is_dirty(thread_current()->pml4, page->va))
-	{
-        lock_acquire(&filesys_lock);
-		file_write_at(file_page->file, page->frame->kva, file_page->read_bytes, file_page->ofs);
-        lock_release(&filesys_lock);
-		pml4_set_dirty(thread_current()->pml4, page->va, false);
-	}
+	// 소유자(현재 스레드가 아닐 수 있음)의 매핑을 dirty 비트를 읽는 것과 함께 끊은 뒤에 쓴다.
+	// 사이에 끼어든 저장이 dirty 비트와 함께 사라지지 않도록 인터럽트를 끈 채로 처리
+	enum intr_level old_level = intr_disable();
+	bool dirty = pml4_is_dirty(pml4, page->va);
+	pml4_clear_page(pml4, page->va);
+	intr_set_level(old_level);
+
+	if (dirty)
+		file_write_at(file_page->file, frame->kva, file_page->read_bytes, file_page->ofs);
 	page->frame->page = NULL;
 	page->frame = NULL;
-	pml4_clear_page(thread_current()->pml4, page->va);
 	return true;
 }
 
@@ -78,9 +78,7 @@ file_backed_destroy (struct page *page) {
 
 	/** Project 3-Memory Mapped Files */
     if (pml4_is_dirty(thread_current()->pml4, page->va)) {
-        lock_acquire(&filesys_lock);
         file_write_at(file_page->file, page->va, file_page->read_bytes, file_page->ofs);
-        lock_release(&filesys_lock);
         pml4_set_dirty(thread_current()->pml4, page->va, false);
     }
 
@@ -100,7 +98,6 @@ do_mmap (void *addr, size_t length, int writable,
 		struct file *file, off_t offset) {
 			
 	/** Project 3-Memory Mapped FIles */
-	lock_acquire(&filesys_lock);
     struct file *mfile = file_reopen(file);
     void *ori_addr = addr;
     size_t read_bytes = (length > file_length(mfile)) ? file_length(mfile) : length;
@@ -133,12 +130,10 @@ do_mmap (void *addr, size_t length, int writable,
         addr += PGSIZE;
         offset += page_read_bytes;
     }
-	lock_release(&filesys_lock);
     return ori_addr;
 
 err:
     free(aux);
-    lock_release(&filesys_lock);
     return NULL;
 }
 
@@ -12,6 +12,7 @@ static bool vm_copy_claim_page(struct supplemental_page_table *dst, void *va, vo
 
 struct list frame_table;
 struct lock frame_lock;
+static struct condition evict_done;	// 페이지 내보내기가 끝날 때 signal (frame_lock과 함께 사용)
 struct list_elem *next = NULL;	// victim 선정용 전역 포인터
 
 /* Initializes the virtual memory subsystem by invoking each subsystem's
@@ -26,6 +27,7 @@ vm_init (void) {
 	register_inspect_intr ();
 	list_init(&frame_table);
 	lock_init(&frame_lock);
+	cond_init(&evict_done);
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -82,6 +84,9 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 
 		uninit_new(page, upage, init, type, aux, initializer);
 		page->writable = writable;
+		// 페이지를 만든 스레드의 페이지 테이블에 매핑됨 (다른 스레드가 내보낼 때 사용)
+		page->owner = thread_current();
+		page->evicting = false;
 		
 		return spt_insert_page(spt, page);
 	}
@@ -118,8 +123,9 @@ vm_get_victim (void) {
 	for (next = list_begin(&frame_table); next != list_end(&frame_table); next = list_next(next))
 	{
 		victim = list_entry(next, struct frame, frame_elem);
-		if (pml4_is_accessed(thread_current()->pml4, victim->page->va)) {
-			pml4_set_accessed(thread_current()->pml4, victim->page->va, false);
+		uint64_t *pml4 = victim->page->owner->pml4;
+		if (pml4_is_accessed(pml4, victim->page->va)) {
+			pml4_set_accessed(pml4, victim->page->va, false);
 		} else {
 			lock_release(&frame_lock);
 			return victim;
@@ -134,9 +140,23 @@ vm_get_victim (void) {
 static struct frame *
 vm_evict_frame (void) {
 	struct frame *victim = vm_get_victim ();
-	if (victim->page)
-		swap_out(victim->page);
-	return victim;
+	struct page *page = victim->page;
+	bool success = true;
+
+	// 내보내는 동안 소유자가 이 페이지에 접근하면 vm_do_claim_page()에서 기다림
+	if (page) {
+		lock_acquire(&frame_lock);
+		page->evicting = true;
+		lock_release(&frame_lock);
+
+		success = swap_out(page);
+
+		lock_acquire(&frame_lock);
+		page->evicting = false;
+		cond_broadcast(&evict_done, &frame_lock);
+		lock_release(&frame_lock);
+	}
+	return success ? victim : NULL;
 }
 
 /* palloc() and get frame. If there is no available page, evict the page
@@ -152,6 +172,9 @@ vm_get_frame (void) {
 
     if (frame->kva == NULL) {
         frame = vm_evict_frame();  
+		// 스왑 슬롯이 없거나 스왑 디스크 오류로 내보내지 못함
+		if (frame == NULL)
+			PANIC("can't evict a frame");
 	} else {
 		lock_acquire(&frame_lock);
         list_push_back(&frame_table, &frame->frame_elem);
@@ -264,6 +287,12 @@ vm_claim_page (void *va UNUSED) {
 /* Claim the PAGE and set up the mmu. */
 static bool
 vm_do_claim_page (struct page *page) {
+	// 다른 스레드가 이 페이지를 내보내는 중이면 디스크에 다 쓸 때까지 기다린 뒤 다시 읽음
+	lock_acquire(&frame_lock);
+	while (page->evicting)
+		cond_wait(&evict_done, &frame_lock);
+	lock_release(&frame_lock);
+
 	struct frame *frame = vm_get_frame ();
 
 	/* Set links */